@@ -1,16 +1,11 @@
-#include <avr/io.h>
 #include <inttypes.h>
 
-#ifndef F_CPU
-//	#define F_CPU 12000000UL
-//	#define F_CPU 1000000UL		//Frequency of uC - AT90USB1287
-   #define F_CPU 8000000UL		//0.5*Frequency of uC - ATmega2560
-#endif
-
-#include <util/delay.h>
-
 #include "lcd.h"
 
+// The pin-level driver (LCDByte, LCDBusyLoop, InitLCD) only exists on the
+// target; host builds get an HD44780 model from sim/lcd_sim.c instead
+#ifdef __AVR__
+
 
 
 #define LCD_DATA_PORT 	PORT(LCD_DATA)
@@ -93,6 +88,29 @@ _delay_us(1);			//tEL
 LCDBusyLoop();
 }
 
+void LCDNibble(uint8_t n,uint8_t isdata)
+{
+//Sends half a byte, high nibble first. The caller must leave the display
+//time to execute between bytes since this does not poll the busy flag.
+
+if(isdata==0)
+	CLEAR_RS();
+else
+	SET_RS();
+
+_delay_us(0.500);		//tAS
+
+SET_E();
+
+LCD_DATA_PORT=(LCD_DATA_PORT & 0XF0)|(n & 0x0F);
+
+_delay_us(1);			//tEH
+
+CLEAR_E();
+
+_delay_us(1);			//tEL
+}
+
 void LCDBusyLoop()
 {
 	//This function waits till lcd is BUSY
@@ -194,7 +212,120 @@ void InitLCD(uint8_t style)
 
 	LCDCmd(0b00001100|style);	//Display On
 	LCDCmd(0b00101000);			//function set 4-bit,2 line 5x7 dot format
+	LCDCmd(0b00000001);			//Clear, the framebuffer takes over from here
+}
+
+#endif /* __AVR__ */
+
+#define LCD_ROWS	2
+#define LCD_COLS	16
+#define LCD_CELLS	(LCD_ROWS * LCD_COLS)
+
+static volatile char frame[LCD_CELLS];		//What the display should show
+static char shown[LCD_CELLS];			//What it shows
+static volatile uint8_t changed = 1;		//Frame written since the last full scan
+static uint8_t row = 0, col = 0;		//Write position
+static uint8_t scan = 0;			//Next cell LCDRefresh() looks at
+static uint8_t address = 0xFF;			//Display's DDRAM address counter, 0xFF if unknown
+static uint8_t out, out_rs, low_pending = 0;	//Byte half sent
+
+static char draft[LCD_CELLS];			//Screen being drawn between LCDDraft() and LCDShow()
+static uint8_t drafting = 0;
+
+static void LCDPut(char c)
+{
+ if(col<LCD_COLS)
+ {
+	if(drafting) draft[row*LCD_COLS+col]=c;
+	else frame[row*LCD_COLS+col]=c;
+ }
+ col++;
+ if(!drafting) changed=1;
 }
+
+void LCDClear(void)
+{
+ for(uint8_t i=0;i<LCD_CELLS;i++)
+ {
+	if(drafting) draft[i]=' ';
+	else frame[i]=' ';
+ }
+ row=0;
+ col=0;
+ if(!drafting) changed=1;
+}
+
+void LCDDraft(void)
+{
+ for(uint8_t i=0;i<LCD_CELLS;i++) draft[i]=frame[i];
+ drafting=1;
+}
+
+void LCDShow(void)
+{
+ if(!drafting) return;
+ drafting=0;
+
+ //Cells the draft left as they were stay unchanged and are not resent
+ uint8_t state=hal_irq_save();
+ for(uint8_t i=0;i<LCD_CELLS;i++) frame[i]=draft[i];
+ changed=1;
+ hal_irq_restore(state);
+}
+
+uint8_t LCDRefresh(void)
+{
+ uint8_t i,n;
+
+ if(low_pending)
+ {
+	LCDNibble(out,out_rs);
+	low_pending=0;
+	return 1;
+ }
+ if(!changed) return 0;
+ changed=0;
+
+ //Find the next cell that differs from the display
+ for(n=0;n<LCD_CELLS;n++)
+ {
+	i=(scan+n)%LCD_CELLS;
+	if(frame[i]!=shown[i]) break;
+ }
+ if(n==LCD_CELLS) return 0;
+ changed=1;
+
+ uint8_t cell_address=((i/LCD_COLS) ? 0x40 : 0x00)|(i%LCD_COLS);
+ if(cell_address!=address)
+ {
+	//Move the display's cursor there first
+	out=0b10000000|cell_address;
+	out_rs=0;
+	address=cell_address;
+	scan=i;
+ }
+ else
+ {
+	out=frame[i];
+	out_rs=1;
+	shown[i]=out;
+	address++;
+	scan=i+1;
+ }
+ LCDNibble(out>>4,out_rs);
+ low_pending=1;
+ return 1;
+}
+
+void LCDFlush(void)
+{
+ LCDShow();
+ uint8_t state=hal_irq_save();	//Keep ISR(TIMER0_OVF_vect) out of the way
+ while(LCDRefresh()) hal_delay_us(50);
+ hal_irq_restore(state);
+}
+
+
 void LCDWriteString(const char *msg)
 {
 	/*****************************************************************
@@ -209,7 +340,7 @@ void LCDWriteString(const char *msg)
 	*****************************************************************/
  while(*msg!='\0')
  {
-	LCDData(*msg);
+	LCDPut(*msg);
 	msg++;
  }
 }
@@ -240,19 +371,18 @@ void LCDWriteInt(int val,unsigned int field_length)
 	else
 		j=5-field_length;
 
-	if(val<0) LCDData('-');
+	if(val<0) LCDPut('-');
 	for(i=j;i<5;i++)
 	{
-	LCDData(48+str[i]);
+	LCDPut(48+str[i]);
 	}
 }
 void LCDGotoXY(uint8_t x,uint8_t y)
 {
  if(x<40)
  {
-  if(y) x|=0b01000000;
-  x|=0b10000000;
-  LCDCmd(x);
+  row=y ? 1 : 0;
+  col=x;
   }
 }
 
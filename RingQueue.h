@@ -0,0 +1,106 @@
+/*
+ * RingQueue.h
+ *
+ * Fixed-capacity item queue. Single producer, single consumer: one side may
+ * run in an ISR while the other runs in the main loop without disabling
+ * interrupts, because each side only ever writes its own index and indices
+ * are single bytes. No heap.
+ *
+ * 's' == steel
+ * 'a' == aluminium
+ * 'b' == black plastic
+ * 'w' == white plastic
+ */
+
+
+#ifndef RINGQUEUE_H_
+#define RINGQUEUE_H_
+
+#include <stdint.h>
+
+#include "hal.h"
+
+#define QUEUE_SIZE	32	// Must be a power of two, at most 128
+
+typedef struct item{
+	char itemType;
+	uint8_t id;		// Running number, to follow the item through the trace
+	uint32_t inbound;	// Belt travel when the item reached the optic sensor
+	uint32_t seen;		// Clock then, stamped in the sensor's ISR
+	uint32_t exited;	// Clock when it reached the exit sensor, 0 until it has
+} item;
+
+typedef struct queue{
+	item buf[QUEUE_SIZE];
+	volatile uint8_t head;		// Next slot to dequeue, written by consumer
+	volatile uint8_t tail;		// Next slot to fill, written by producer
+	volatile uint8_t overflows;	// Items dropped because the queue was full
+} queue;
+
+// Indices run freely and wrap at 256, so tail - head is always the size
+static inline uint8_t size(queue *q)
+{
+	return (uint8_t)(q->tail - q->head);
+}
+
+static inline char isEmpty(queue *q)
+{
+	return q->tail == q->head;
+}
+
+static inline void setup(queue *q)
+{
+	q->head = 0;
+	q->tail = 0;
+	q->overflows = 0;
+}
+
+// Returns 0 and counts an overflow if the queue is full
+static inline char enqueue(queue *q, const item *newItem)
+{
+	uint8_t tail = q->tail;
+
+	if((uint8_t)(tail - q->head) >= QUEUE_SIZE)
+	{
+		q->overflows++;
+		return 0;
+	}
+	q->buf[tail & (QUEUE_SIZE - 1)] = *newItem;
+	hal_barrier();
+	q->tail = tail + 1;
+	return 1;
+}
+
+// Returns 0 if the queue is empty
+static inline char dequeue(queue *q, item *oldItem)
+{
+	uint8_t head = q->head;
+
+	if(head == q->tail) return 0;
+	*oldItem = q->buf[head & (QUEUE_SIZE - 1)];
+	hal_barrier();
+	q->head = head + 1;
+	return 1;
+}
+
+// n-th item from the head, or NULL if there are not that many queued
+static inline item *peek(queue *q, uint8_t n)
+{
+	if(n >= size(q)) return 0;
+	return &q->buf[(uint8_t)(q->head + n) & (QUEUE_SIZE - 1)];
+}
+
+// Type of the head item, 'E' if empty
+static inline char firstValue(queue *q)
+{
+	item *first = peek(q, 0);
+	return first ? first->itemType : 'E';
+}
+
+// Consumer side only
+static inline void clearQueue(queue *q)
+{
+	q->head = q->tail;
+}
+
+#endif /* RINGQUEUE_H_ */
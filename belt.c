@@ -0,0 +1,164 @@
+#include "hal.h"
+#include "clock.h"
+#include "belt.h"
+#include "trace.h"
+
+static volatile uint8_t wanted = 0;	// Sorting logic wants the belt running
+static volatile uint8_t held = 0;	// Paused
+static volatile uint8_t moving = 0;	// Motor state actually applied
+
+static uint8_t reference;		// Duty cycle the odometer counts in
+static uint8_t duty;
+static uint8_t peak;
+
+// Odometer in duty % x clock ticks, so ISRs read it with a multiply and
+// no divide. It wraps every few minutes of running; readings are turned
+// into reference ticks against an anchor the main loop keeps moving.
+static uint32_t odometer = 0;		// Distance up to the last change
+static uint32_t started;		// Clock at the last change while running
+static uint32_t origin;			// Clock at belt_init()
+static uint32_t anchor = 0;		// Odometer reading ...
+static uint32_t anchor_travel = 0;	// ... and the same in reference ticks
+
+// Bring the odometer up to now. Interrupts must be off.
+static void fold(void)
+{
+	uint32_t now = clock_now();
+
+	if(moving) odometer += duty * (now - started);
+	started = now;
+}
+
+// Drive the motor to match wanted and held. Interrupts must be off.
+static void apply(void)
+{
+	uint8_t run = wanted && !held;
+
+	if(run == moving) return;
+	fold();
+	if(run)
+	{
+		hal_belt_run();
+		if(duty > peak) peak = duty;
+		trace(TRACE_BELT_RUN, TRACE_NONE, duty);
+	}
+	else
+	{
+		hal_belt_brake();
+		trace(TRACE_BELT_STOP, TRACE_NONE, held);
+	}
+	moving = run;
+}
+
+void belt_init(uint8_t percent)
+{
+	hal_belt_duty(percent);
+	reference = percent;
+	duty = percent;
+	peak = 0;
+	odometer = 0;
+	anchor = 0;
+	anchor_travel = 0;
+	wanted = 1;
+	held = 0;
+	moving = 0;
+
+	uint8_t state = hal_irq_save();
+	origin = clock_now();
+	apply();
+	hal_irq_restore(state);
+}
+
+void belt_run(void)
+{
+	uint8_t state = hal_irq_save();
+	wanted = 1;
+	apply();
+	hal_irq_restore(state);
+}
+
+void belt_stop(void)
+{
+	uint8_t state = hal_irq_save();
+	wanted = 0;
+	apply();
+	hal_irq_restore(state);
+}
+
+void belt_hold(uint8_t hold)
+{
+	uint8_t state = hal_irq_save();
+	held = hold;
+	apply();
+	hal_irq_restore(state);
+}
+
+void belt_duty(uint8_t percent)
+{
+	// The governor calls this every period, which keeps the anchor close
+	belt_travel();
+	if(percent == duty) return;
+
+	uint8_t state = hal_irq_save();
+	fold();
+	duty = percent;
+	hal_belt_duty(percent);
+	if(moving && duty > peak) peak = duty;
+	hal_irq_restore(state);
+}
+
+uint8_t belt_speed(void)
+{
+	return duty;
+}
+
+uint8_t belt_moving(void)
+{
+	return moving;
+}
+
+uint32_t belt_odometer(void)
+{
+	uint8_t state = hal_irq_save();
+	uint32_t o = odometer;
+	if(moving) o += duty * (clock_now() - started);
+	hal_irq_restore(state);
+
+	return o;
+}
+
+uint32_t belt_travel_at(uint32_t reading)
+{
+	int32_t ahead = reading - anchor;
+
+	// Readings from the past leave the anchor where it is
+	if(ahead < 0) return anchor_travel - (uint32_t)-ahead / reference;
+
+	// Keep the remainder in the odometer so no travel is lost
+	uint32_t ticks = (uint32_t)ahead / reference;
+	anchor += ticks * reference;
+	anchor_travel += ticks;
+	return anchor_travel;
+}
+
+uint32_t belt_travel(void)
+{
+	return belt_travel_at(belt_odometer());
+}
+
+uint32_t belt_span(uint32_t readings)
+{
+	return readings / reference;
+}
+
+uint8_t belt_peak(void)
+{
+	return peak;
+}
+
+uint8_t belt_average(void)
+{
+	uint32_t elapsed = (clock_now() - origin) / reference;
+
+	return elapsed ? belt_travel() / elapsed : 0;
+}
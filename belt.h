@@ -0,0 +1,37 @@
+/*
+ * belt.h
+ *
+ * Conveyor motor control. The sorting logic asks for the belt to run or
+ * stop and the pause button can hold it on top of that, so resuming from a
+ * pause never restarts a belt the sorter wants stopped. Keeps an odometer
+ * of how far the belt has moved, in clock ticks of running at the duty
+ * cycle given to belt_init(), so item positions stay comparable while the
+ * duty cycle changes.
+ *
+ * ISRs take a raw belt_odometer() reading, which costs no divide, and the
+ * main loop turns it into travel with belt_travel_at(). Readings must be
+ * converted within two minutes of being taken, and belt_travel() or
+ * belt_duty() called as often while the belt runs.
+ */
+
+
+#ifndef BELT_H_
+#define BELT_H_
+
+#include <stdint.h>
+
+void		belt_init	(uint8_t duty);		// Reference duty cycle %, belt left running
+void		belt_run	(void);
+void		belt_stop	(void);
+void		belt_hold	(uint8_t hold);		// Pause button, from the main loop
+void		belt_duty	(uint8_t duty);		// Duty cycle %, takes effect immediately
+uint8_t		belt_speed	(void);			// Duty cycle % currently set
+uint8_t		belt_moving	(void);
+uint32_t	belt_travel	(void);			// Clock ticks at the reference duty since belt_init()
+uint32_t	belt_odometer	(void);			// Raw reading, any context
+uint32_t	belt_travel_at	(uint32_t reading);	// ... as belt_travel() was then
+uint32_t	belt_span	(uint32_t readings);	// Difference of two readings in reference ticks
+uint8_t		belt_peak	(void);			// Highest duty cycle % the belt has run at
+uint8_t		belt_average	(void);			// Mean duty cycle % since belt_init(), stops included
+
+#endif /* BELT_H_ */
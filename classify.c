@@ -0,0 +1,92 @@
+#include "clock.h"
+#include "classify.h"
+
+// Baseline the centroids were taken at; the minimum is compared as if
+// ambient light were still what it was then
+#define CLASSIFY_BASELINE	990
+
+// Fixed point scale of a distance in spreads
+#define CLASSIFY_ONE	16
+
+typedef struct centroid{
+	char type;
+	int16_t mean[CLASSIFY_FEATURES];
+	int16_t spread[CLASSIFY_FEATURES];	// Standard deviation, 0 to leave the feature out
+} centroid;
+
+// The minimum is seeded from the thresholds calibrated on the line
+// (aluminium under 255, steel under 750, white under 900), each mean
+// halfway between two and each spread putting the thresholds about 2.5
+// spreads from the means either side. Depth and slope were fitted to the
+// simulator's plant model only. Every class is the same length, so the
+// length is left out; it would only add belt speed and item size
+// variation. Refit the table from CALIBRATION_MODE on the hardware.
+static const centroid centroids[CLASSES] = {
+	{ 'a', { 128, 668, 131, 416 }, { 51, 55, 0, 200 } },
+	{ 's', { 500, 389, 131, 246 }, { 100, 55, 0, 122 } },
+	{ 'w', { 825, 89, 129, 53 }, { 30, 8, 0, 25 } },
+	{ 'b', { 960, 31, 126, 22 }, { 24, 8, 0, 12 } },
+};
+
+void classify_features(const measurement *m, int16_t f[CLASSIFY_FEATURES])
+{
+	uint16_t drop = (m->min < m->threshold) ? m->threshold - m->min : 0;
+
+	f[CLASSIFY_MIN] = (int16_t)m->min + CLASSIFY_BASELINE - (int16_t)m->baseline;
+	f[CLASSIFY_DEPTH] = m->dwell ? m->area / m->dwell : 0;
+	f[CLASSIFY_LENGTH] = m->length / CLOCK_MS(1);
+
+	// The travel on the leading edge is its share of the samples below
+	// the threshold, the belt speed being steady over one item
+	uint32_t fall = m->dwell ? m->length * m->fall / m->dwell : 0;
+	uint32_t slope = (uint32_t)drop * CLOCK_MS(10) / (fall ? fall : 1);
+	f[CLASSIFY_SLOPE] = (slope > 0x7FFF) ? 0x7FFF : slope;
+}
+
+static uint32_t distance(const centroid *c, const int16_t f[CLASSIFY_FEATURES])
+{
+	uint32_t d = 0;
+
+	for(uint8_t i = 0; i < CLASSIFY_FEATURES; i++)
+	{
+		if(!c->spread[i]) continue;
+		int32_t z = ((int32_t)f[i] - c->mean[i]) * CLASSIFY_ONE / c->spread[i];
+		if(z > 0x7FFF) z = 0x7FFF;
+		if(z < -0x7FFF) z = -0x7FFF;
+		d += (uint32_t)(z * z) >> 2;
+	}
+	return d;
+}
+
+char classify(const measurement *m, uint8_t *confidence)
+{
+	int16_t f[CLASSIFY_FEATURES];
+	uint32_t best = 0xFFFFFFFF;
+	uint32_t second = 0xFFFFFFFF;
+	char type = 'b';
+
+	classify_features(m, f);
+	for(uint8_t i = 0; i < CLASSES; i++)
+	{
+		uint32_t d = distance(&centroids[i], f);
+		if(d < best)
+		{
+			second = best;
+			best = d;
+			type = centroids[i].type;
+		}
+		else if(d < second)
+		{
+			second = d;
+		}
+	}
+
+	// 100% when the item sits on the centroid, 0% halfway between two
+	while(second > 0x00FFFFFF)
+	{
+		second >>= 1;
+		best >>= 1;
+	}
+	*confidence = (second - best) * 100 / (second + best + 1);
+	return type;
+}
@@ -0,0 +1,33 @@
+/*
+ * classify.h
+ *
+ * Item classification from the shape of its dip in reflectance, rather
+ * than the minimum alone. Four features are taken from a measurement: the
+ * minimum, the mean depth below the no-item threshold, the length of the
+ * dip in belt travel and the steepness of its leading edge. None depend on
+ * the belt speed. The item goes to the class whose centroid is nearest,
+ * each feature scaled by that class's spread, all in fixed point. A
+ * feature with no spread in the table is measured but not compared.
+ */
+
+
+#ifndef CLASSIFY_H_
+#define CLASSIFY_H_
+
+#include <stdint.h>
+#include "measure.h"
+
+#define CLASSES		4
+#define CLASSIFY_SURE	50	// Confidence % below which a classification is counted as doubtful
+
+// Features, index what classify_features() fills in
+#define CLASSIFY_MIN	0	// Lowest reflectance, as if at the baseline the centroids were taken at
+#define CLASSIFY_DEPTH	1	// Mean counts below the threshold
+#define CLASSIFY_LENGTH	2	// ms below the threshold, at the reference belt speed
+#define CLASSIFY_SLOPE	3	// Leading edge, counts per 10ms of travel
+#define CLASSIFY_FEATURES	4
+
+char	classify	(const measurement *m, uint8_t *confidence);	// Item type, and % by which the nearest class won
+void	classify_features(const measurement *m, int16_t f[CLASSIFY_FEATURES]);	// What classify() compares, for calibration
+
+#endif /* CLASSIFY_H_ */
@@ -0,0 +1,30 @@
+#include "hal.h"
+#include "clock.h"
+
+// High half of the clock, counted by ISR(TIMER5_OVF_vect)
+static volatile uint16_t overflows = 0;
+
+void clock_init(void)
+{
+	overflows = 0;
+	hal_timer_ovf_enable(HAL_TIMER_CLOCK);
+}
+
+uint32_t clock_now(void)
+{
+	uint8_t state = hal_irq_save();
+	uint16_t high = overflows;
+	uint16_t low = hal_timer_count(HAL_TIMER_CLOCK);
+
+	// The counter wrapped after interrupts went off but before the count
+	// was read; a small count means it belongs to the next overflow
+	if(hal_timer_ovf_pending(HAL_TIMER_CLOCK) && low < 0x8000) high++;
+	hal_irq_restore(state);
+
+	return ((uint32_t)high << 16) | low;
+}
+
+void clock_overflow(void)
+{
+	overflows++;
+}
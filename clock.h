@@ -0,0 +1,23 @@
+/*
+ * clock.h
+ *
+ * Free-running system clock. Timer5 counts at 125kHz with nothing else on
+ * it and ISR(TIMER5_OVF_vect) extends the count to 32 bits, so any context
+ * can take an 8us timestamp without stopping a timer. Wraps after about
+ * 9.5 hours; compare timestamps by subtraction.
+ */
+
+
+#ifndef CLOCK_H_
+#define CLOCK_H_
+
+#include <stdint.h>
+
+#define CLOCK_HZ	125000UL
+#define CLOCK_MS(ms)	((uint32_t)(ms) * (CLOCK_HZ / 1000))	// Milliseconds to clock ticks
+
+void		clock_init	(void);
+uint32_t	clock_now	(void);		// Ticks since clock_init(), safe in any context
+void		clock_overflow	(void);		// Timer5 overflow, ISR context
+
+#endif /* CLOCK_H_ */
@@ -0,0 +1,60 @@
+#include "hal.h"
+#include "clock.h"
+#include "events.h"
+
+// Timer0 overflows every 256us
+#define DEBOUNCE_TICKS	((DEBOUNCE_TIME * 1000UL + 255) / 256)
+
+// ISRs do not nest, so all of them together are the single producer
+static event queued[EVENT_SLOTS];
+static volatile uint8_t head = 0;
+static volatile uint8_t tail = 0;
+volatile uint8_t event_overruns = 0;
+
+// Ticks left before each external interrupt is unmasked, 0 if not masked
+static uint8_t masked[8];
+
+void event_post(uint8_t type)
+{
+	uint8_t t = tail;
+
+	if((uint8_t)(t - head) >= EVENT_SLOTS)
+	{
+		event_overruns++;
+		return;
+	}
+	queued[t & (EVENT_SLOTS - 1)].type = type;
+	queued[t & (EVENT_SLOTS - 1)].time = clock_now();
+	hal_barrier();
+	tail = t + 1;
+}
+
+char event_next(event *e)
+{
+	uint8_t h = head;
+
+	if(h == tail) return 0;
+	*e = queued[h & (EVENT_SLOTS - 1)];
+	hal_barrier();
+	head = h + 1;
+	return 1;
+}
+
+void debounce(uint8_t num)
+{
+	hal_extint_disable(num);
+	masked[num] = DEBOUNCE_TICKS;
+}
+
+void events_tick(void)
+{
+	for(uint8_t num = 0; num < 8; num++)
+	{
+		if(masked[num] && --masked[num] == 0)
+		{
+			// Forget the bounces and listen again
+			hal_extint_clear(num);
+			hal_extint_enable(num);
+		}
+	}
+}
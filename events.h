@@ -0,0 +1,36 @@
+/*
+ * events.h
+ *
+ * Deferred handling for the operator buttons. Their ISRs only timestamp
+ * the edge, queue an event and mask the input; ISR(TIMER0_OVF_vect) counts
+ * the bounce out and unmasks it again. The main loop acts on the events, so
+ * no ISR ever waits and the time any interrupt can be held off is bounded
+ * by the longest ISR body.
+ */
+
+
+#ifndef EVENTS_H_
+#define EVENTS_H_
+
+#include <stdint.h>
+
+#define EVENT_SLOTS	8	// Power of two
+#define DEBOUNCE_TIME	20	// ms an input stays masked after an edge
+
+// Event types
+#define EVENT_PAUSE	1	// Pause/resume button pressed
+#define EVENT_RAMP	2	// Ramp down button pressed
+
+typedef struct event{
+	uint8_t type;
+	uint32_t time;		// Clock at the edge
+} event;
+
+void	event_post	(uint8_t type);		// ISR context
+char	event_next	(event *e);		// Returns 0 if nothing is queued
+void	debounce	(uint8_t num);		// Mask external interrupt 'num' for DEBOUNCE_TIME, ISR context
+void	events_tick	(void);			// Timer0 overflow, ISR context
+
+extern volatile uint8_t event_overruns;		// Events lost to a full queue
+
+#endif /* EVENTS_H_ */
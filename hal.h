@@ -0,0 +1,425 @@
+/*
+ * hal.h
+ *
+ * Thin hardware abstraction layer between the sorting logic and the
+ * ATmega2560. On the target every call below is a static inline register
+ * access, so the generated code is the same as poking the registers
+ * directly. On a host build (no __AVR__) the calls are routed to the plant
+ * simulator in sim/, which models the belt, sensors, dish and LCD.
+ */
+
+
+#ifndef HAL_H_
+#define HAL_H_
+
+#include <stdint.h>
+
+// Hardware timers used by the firmware (numbers match the AVR timers)
+#define HAL_TIMER_PWM		0	// Belt PWM, overflows every 256us
+#define HAL_TIMER_STEPPER	1	// Stepper step interval, 1MHz
+#define HAL_TIMER_MS		2	// Millisecond tick for mTimer(), 250kHz
+#define HAL_TIMER_ADC		3	// ADC conversion timer, 125kHz
+#define HAL_TIMER_EXIT		4	// Spare, 125kHz
+#define HAL_TIMER_CLOCK		5	// Free-running system clock, 125kHz
+
+// External interrupts (numbers match INT0-INT5)
+#define HAL_INT_KILL		0	// Killswitch, any edge
+#define HAL_INT_PAUSE		1	// Pause/resume, rising edge
+#define HAL_INT_HOME		2	// Homing sensor, falling edge
+#define HAL_INT_RAMP		3	// Ramp down, falling edge
+#define HAL_INT_EXIT		4	// Exit sensor, falling edge
+#define HAL_INT_OPTIC		5	// Optic sensor, rising edge
+
+// USART0, 8N1, to the programming header's serial bridge
+#define HAL_UART_BAUD		38400
+
+// Keeps the compiler from moving stores to a ring shared with an ISR
+// across the index update that publishes them
+static inline void hal_barrier(void)
+{
+	__asm__ __volatile__("" ::: "memory");
+}
+
+#ifdef __AVR__
+
+#ifndef F_CPU
+#define F_CPU 8000000UL
+#endif
+
+#include <avr/eeprom.h>
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <util/delay.h>
+
+// Clock, IO direction, timer modes, PWM, ADC and interrupt sense setup.
+// Timer TOP values and interrupt masks are left to the caller.
+static inline void hal_init(void)
+{
+	// 8MHz system clock
+	CLKPR = 0x80;
+	CLKPR = 0x01;
+
+	// IO
+	DDRB = 0x80;
+	DDRL = 0xF0;
+	PORTL |= 0x70;
+	DDRA = 0xFF;
+	DDRC = 0xFF;
+	DDRK = 0xFF;
+	DDRF = 0xC0;
+
+	// Free-running system clock, normal mode, 125kHz
+	TCCR5B |= _BV(CS51) | _BV(CS50);
+
+	// Set exit timer to CTC mode, 125kHz
+	TCCR4B |= _BV(WGM42);
+	TCCR4B |= _BV(CS41) | _BV(CS40);
+
+	// Set ADC conversion timer to CTC mode, 125kHz
+	TCCR3B |= _BV(WGM32);
+	TCCR3B |= _BV(CS31) | _BV(CS30);
+
+	// 1MHz millisecond timer counter
+	TCCR2A |= _BV(WGM21);
+	TCCR2B |= _BV(CS21) | _BV(CS20);
+	OCR2A = 250;
+
+	// Stepper step timer to CTC mode, 1MHz
+	TCCR1B |= _BV(CS11);
+	TCCR1B |= _BV(WGM12);
+
+	// 3.9kHz PWM
+	TCCR0A |= _BV(WGM01) | _BV(WGM00);
+	TCCR0A |= _BV(COM0A1);
+	TCCR0B |= _BV(CS01);
+
+	// Enable ADC with automatic interrupts after conversion success
+	ADCSRA |= _BV(ADEN);
+	ADCSRA |= _BV(ADIE);
+	ADMUX |=_BV(REFS0);
+
+	// INT0 any edge, INT1 rising edge, INT2/INT3/INT4 falling edge,
+	// INT5 rising edge
+	EICRA |= _BV(ISC00) | _BV(ISC10) | _BV(ISC11) | _BV(ISC21) | _BV(ISC31);
+	EICRB |= _BV(ISC41) | _BV(ISC51) | _BV(ISC50);
+}
+
+// Nothing to yield to on the target
+static inline void hal_idle(void)
+{
+}
+
+// Park the CPU for good
+static inline void hal_halt(void)
+{
+	while(1);
+}
+
+// Busy wait, for short hardware setup times only
+static inline void hal_delay_us(uint16_t us)
+{
+	while(us--) _delay_us(1);
+}
+
+// Disable interrupts and return the previous state for hal_irq_restore()
+static inline uint8_t hal_irq_save(void)
+{
+	uint8_t sreg = SREG;
+	cli();
+	return sreg;
+}
+
+static inline void hal_irq_restore(uint8_t state)
+{
+	SREG = state;
+}
+
+/* Non-volatile storage, the EEPROM */
+
+static inline void hal_nv_read(uint16_t addr, void *buf, uint16_t len)
+{
+	eeprom_read_block(buf, (const void *)addr, len);
+}
+
+// Only bytes that differ are written, to spare the cells
+static inline void hal_nv_write(uint16_t addr, const void *buf, uint16_t len)
+{
+	eeprom_update_block(buf, (void *)addr, len);
+}
+
+/* Serial, USART0 */
+
+// Double speed for a 0.2% baud rate error at 8MHz. Each byte received
+// raises USART0_RX_vect.
+static inline void hal_uart_init(void)
+{
+	UBRR0 = F_CPU / 8 / HAL_UART_BAUD - 1;
+	UCSR0A = _BV(U2X0);
+	UCSR0B = _BV(TXEN0) | _BV(RXEN0) | _BV(RXCIE0);
+	UCSR0C = _BV(UCSZ01) | _BV(UCSZ00);
+}
+
+// Only valid inside ISR(USART0_RX_vect)
+static inline uint8_t hal_uart_recv(void)
+{
+	return UDR0;
+}
+
+// Only once the data register is empty, i.e. from ISR(USART0_UDRE_vect)
+static inline void hal_uart_send(uint8_t byte)
+{
+	UDR0 = byte;
+}
+
+// Data register empty interrupt, raised for as long as it stays empty
+static inline void hal_uart_irq_enable(void)
+{
+	UCSR0B |= _BV(UDRIE0);
+}
+
+static inline void hal_uart_irq_disable(void)
+{
+	UCSR0B &= ~_BV(UDRIE0);
+}
+
+/* Belt */
+
+static inline void hal_belt_run(void)
+{
+	PORTL &= 0x7F;
+}
+
+static inline void hal_belt_brake(void)
+{
+	PORTL |= 0xF0;
+}
+
+// Duty cycle %
+static inline void hal_belt_duty(uint8_t percent)
+{
+	OCR0A = percent * 255 / 100;
+}
+
+/* Stepper */
+
+static inline void hal_stepper_write(uint8_t pattern)
+{
+	PORTA = pattern;
+}
+
+/* Sensors */
+
+// Non-zero while an item is in front of the optic sensor
+static inline uint8_t hal_optic_active(void)
+{
+	return PINE & _BV(PINE5);
+}
+
+static inline void hal_adc_start(void)
+{
+	ADCSRA |= _BV(ADSC);
+}
+
+// Auto-triggered conversions back to back at a 125kHz ADC clock (about
+// 9.6k samples/s), each one raising ADC_vect
+static inline void hal_adc_free_run(void)
+{
+	ADCSRA |= _BV(ADPS2) | _BV(ADPS1);
+	ADCSRB &= ~(_BV(ADTS2) | _BV(ADTS1) | _BV(ADTS0));
+	ADCSRA |= _BV(ADATE);
+	ADCSRA |= _BV(ADSC);
+}
+
+// Only valid inside ISR(ADC_vect)
+static inline uint16_t hal_adc_read(void)
+{
+	uint16_t result = ADCL;
+	result |= (ADCH & 0x03) << 8;
+	return result;
+}
+
+/* Timers */
+
+static inline void hal_timer_set_top(uint8_t timer, uint16_t top)
+{
+	switch(timer)
+	{
+		case 1: OCR1A = top; break;
+		case 2: OCR2A = top; break;
+		case 3: OCR3A = top; break;
+		case 4: OCR4A = top; break;
+		case 5: OCR5A = top; break;
+	}
+}
+
+// Zero the counter and clear the compare flag
+static inline void hal_timer_restart(uint8_t timer)
+{
+	switch(timer)
+	{
+		case 1: TCNT1 = 0x0000; TIFR1 |= _BV(OCF1A); break;
+		case 2: TCNT2 = 0x00; TIFR2 |= _BV(OCF2A); break;
+		case 3: TCNT3 = 0x0000; TIFR3 |= _BV(OCF3A); break;
+		case 4: TCNT4 = 0x0000; TIFR4 |= _BV(OCF4A); break;
+		case 5: TCNT5 = 0x0000; TIFR5 |= _BV(OCF5A); break;
+	}
+}
+
+// Non-zero once the counter has reached TOP since the flag was last cleared
+static inline uint8_t hal_timer_expired(uint8_t timer)
+{
+	switch(timer)
+	{
+		case 1: return TIFR1 & _BV(OCF1A);
+		case 2: return TIFR2 & _BV(OCF2A);
+		case 3: return TIFR3 & _BV(OCF3A);
+		case 4: return TIFR4 & _BV(OCF4A);
+		case 5: return TIFR5 & _BV(OCF5A);
+	}
+	return 0;
+}
+
+static inline void hal_timer_clear(uint8_t timer)
+{
+	switch(timer)
+	{
+		case 1: TIFR1 |= _BV(OCF1A); break;
+		case 2: TIFR2 |= _BV(OCF2A); break;
+		case 3: TIFR3 |= _BV(OCF3A); break;
+		case 4: TIFR4 |= _BV(OCF4A); break;
+		case 5: TIFR5 |= _BV(OCF5A); break;
+	}
+}
+
+static inline uint16_t hal_timer_count(uint8_t timer)
+{
+	switch(timer)
+	{
+		case 0: return TCNT0;
+		case 1: return TCNT1;
+		case 2: return TCNT2;
+		case 3: return TCNT3;
+		case 4: return TCNT4;
+		case 5: return TCNT5;
+	}
+	return 0;
+}
+
+// Compare match A interrupt
+static inline void hal_timer_irq_enable(uint8_t timer)
+{
+	switch(timer)
+	{
+		case 1: TIMSK1 |= _BV(OCIE1A); break;
+		case 2: TIMSK2 |= _BV(OCIE2A); break;
+		case 3: TIMSK3 |= _BV(OCIE3A); break;
+		case 4: TIMSK4 |= _BV(OCIE4A); break;
+		case 5: TIMSK5 |= _BV(OCIE5A); break;
+	}
+}
+
+static inline void hal_timer_irq_disable(uint8_t timer)
+{
+	switch(timer)
+	{
+		case 1: TIMSK1 &= ~_BV(OCIE1A); break;
+		case 2: TIMSK2 &= ~_BV(OCIE2A); break;
+		case 3: TIMSK3 &= ~_BV(OCIE3A); break;
+		case 4: TIMSK4 &= ~_BV(OCIE4A); break;
+		case 5: TIMSK5 &= ~_BV(OCIE5A); break;
+	}
+}
+
+// Overflow interrupt, for timers left free running
+static inline void hal_timer_ovf_enable(uint8_t timer)
+{
+	switch(timer)
+	{
+		case 0: TIMSK0 |= _BV(TOIE0); break;
+		case 1: TIMSK1 |= _BV(TOIE1); break;
+		case 2: TIMSK2 |= _BV(TOIE2); break;
+		case 3: TIMSK3 |= _BV(TOIE3); break;
+		case 4: TIMSK4 |= _BV(TOIE4); break;
+		case 5: TIMSK5 |= _BV(TOIE5); break;
+	}
+}
+
+// Non-zero while an overflow is waiting for its ISR
+static inline uint8_t hal_timer_ovf_pending(uint8_t timer)
+{
+	switch(timer)
+	{
+		case 0: return TIFR0 & _BV(TOV0);
+		case 1: return TIFR1 & _BV(TOV1);
+		case 2: return TIFR2 & _BV(TOV2);
+		case 3: return TIFR3 & _BV(TOV3);
+		case 4: return TIFR4 & _BV(TOV4);
+		case 5: return TIFR5 & _BV(TOV5);
+	}
+	return 0;
+}
+
+/* External interrupts */
+
+static inline void hal_extint_enable(uint8_t num)
+{
+	EIMSK |= _BV(num);
+}
+
+static inline void hal_extint_disable(uint8_t num)
+{
+	EIMSK &= ~_BV(num);
+}
+
+// Drop a pending edge, e.g. bounces recorded while debouncing
+static inline void hal_extint_clear(uint8_t num)
+{
+	EIFR |= _BV(num);
+}
+
+#else /* Host build against sim/ */
+
+void		hal_init		(void);
+void		hal_idle		(void);	// Advances simulated time to the next plant event
+void		hal_halt		(void);	// Ends the simulation and prints the report
+void		hal_delay_us		(uint16_t us);
+uint8_t		hal_irq_save		(void);
+void		hal_irq_restore		(uint8_t state);
+void		hal_nv_read		(uint16_t addr, void *buf, uint16_t len);
+void		hal_nv_write		(uint16_t addr, const void *buf, uint16_t len);
+void		hal_uart_init		(void);
+void		hal_uart_send		(uint8_t byte);
+uint8_t		hal_uart_recv		(void);
+void		hal_uart_irq_enable	(void);
+void		hal_uart_irq_disable	(void);
+void		hal_belt_run		(void);
+void		hal_belt_brake		(void);
+void		hal_belt_duty		(uint8_t percent);
+void		hal_stepper_write	(uint8_t pattern);
+uint8_t		hal_optic_active	(void);
+void		hal_adc_start		(void);
+void		hal_adc_free_run	(void);
+uint16_t	hal_adc_read		(void);
+void		hal_timer_set_top	(uint8_t timer, uint16_t top);
+void		hal_timer_restart	(uint8_t timer);
+uint8_t		hal_timer_expired	(uint8_t timer);
+void		hal_timer_clear		(uint8_t timer);
+uint16_t	hal_timer_count		(uint8_t timer);
+void		hal_timer_irq_enable	(uint8_t timer);
+void		hal_timer_irq_disable	(uint8_t timer);
+void		hal_timer_ovf_enable	(uint8_t timer);
+uint8_t		hal_timer_ovf_pending	(uint8_t timer);
+void		hal_extint_enable	(uint8_t num);
+void		hal_extint_disable	(uint8_t num);
+void		hal_extint_clear	(uint8_t num);
+void		hal_sei			(void);
+void		hal_cli			(void);
+
+// Interrupt vectors become plain functions the simulator calls
+#define ISR(vector)	void vector(void)
+#define sei()		hal_sei()
+#define cli()		hal_cli()
+
+#endif /* __AVR__ */
+
+#endif /* HAL_H_ */
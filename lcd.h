@@ -1,4 +1,4 @@
-#include <avr/io.h>
+#include "hal.h"
 
 #ifndef F_CPU
 //	#define F_CPU 12000000UL
@@ -6,7 +6,9 @@
    #define F_CPU 8000000UL		//0.5*Frequency of uC - ATmega2560
 #endif
 
+#ifdef __AVR__
 #include <util/delay.h>
+#endif
 
 #include "myutils.h"
 
@@ -49,9 +51,24 @@ void InitLCD(uint8_t style);
 void LCDWriteString(const char *msg);
 void LCDWriteInt(int val,unsigned int field_length);
 void LCDGotoXY(uint8_t x,uint8_t y);
+void LCDClear(void);
+
+//Display calls above only write a 2x16 framebuffer. LCDRefresh() sends
+//one nibble of whatever has changed and is called from ISR(TIMER0_OVF_vect)
+//every 256us, which is longer than the display needs per nibble, so it
+//never waits on the busy flag. Returns 0 once the display is up to date.
+uint8_t LCDRefresh(void);
+
+//Between LCDDraft() and LCDShow() the calls above draw into a scratch
+//screen, which LCDShow() puts in the framebuffer at once. A redraw that
+//starts with LCDClear() then never reaches the display half done.
+void LCDDraft(void);
+void LCDShow(void);
+void LCDFlush(void);		//Send everything now, e.g. before halting with interrupts off
 
 //Low level
 void LCDByte(uint8_t,uint8_t);
+void LCDNibble(uint8_t,uint8_t);
 #define LCDCmd(c) (LCDByte(c,0))
 #define LCDData(d) (LCDByte(d,1))
 
@@ -69,8 +86,7 @@ void LCDBusyLoop();
 /***************************************************
 	M A C R O S
 ***************************************************/
-#define LCDClear() LCDCmd(0b00000001)
-#define LCDHome() LCDCmd(0b00000010);
+#define LCDHome() LCDGotoXY(0,0)
 
 #define LCDWriteStringXY(x,y,msg) {\
  LCDGotoXY(x,y);\
@@ -9,41 +9,98 @@
 # DATA
 # REVISED ############################################*/
 
-#include <avr/interrupt.h>
-#include <avr/io.h>
-#include <stdlib.h>
+#include "hal.h"
 #include "lcd.h"
 #include "stepper.h"
-#include "LinkedQueue.h"
+#include "RingQueue.h"
+#include "measure.h"
+#include "classify.h"
+#include "motion.h"
+#include "clock.h"
+#include "belt.h"
+#include "planner.h"
+#include "profile.h"
+#include "events.h"
+#include "sched.h"
+#include "trace.h"
+#include "uart.h"
+#include "telemetry.h"
+#include "param.h"
 
 //#define PRECALIBRATION_MODE
 //#define TIMER_CALIBRATION_MODE
 //#define EXIT_CALIBRATION_MODE
 //#define CALIBRATION_MODE
+//#define TUNING_MODE
 
 #ifndef SYSTEM_PARAMETERS
 #define SYSTEM_PARMETERS
-#define NO_ITEM_THRESHOLD	984	// Lowest sensor value when no item is present
-#define ALUMINIUM_MAX		255	// Highest expected value for aluminium
-#define STEEL_MAX		750	// Highest expected value for steel
-#define WHITE_MAX		900	// Highest expected value for white plastic
-#define BELT_SPEED		38	// Duty cycle %
-#define ADC_STOPWATCH		6903	// Divide by 125 to get ms
-#define ROLLOFF_DELAY		250
-#define NO_TURN_DELAY		20	// ms
-#define QUARTER_TURN_DELAY	10	// ms
+#define NO_ITEM_THRESHOLD	984	// Lowest sensor value when no item is present, TIMER_CALIBRATION_MODE only
+#define AMBIENT_DEVIANCE	8	// Sensor value +/- due to ambient lighting
+#define NO_ITEM_MARGIN		(2 * AMBIENT_DEVIANCE)	// ADC counts under the tracked no-item baseline at which an item is present
+#define BELT_SPEED		38	// Duty cycle %, belt travel delays below are at this speed
+#define BELT_MIN		20	// Slowest the governor runs the belt, duty cycle %
+#define BELT_MAX		55	// Fastest, with nothing queued
+#define GOVERN_DEPTH		4	// Queued items at which the belt is back to BELT_SPEED
+#define GOVERN_PERIOD		10	// ms between belt speed updates
+#define GOVERN_SLEW		2	// Largest speed increase per update, duty cycle %
+#define EXIT_TRANSIT		2630	// ms of belt travel from optic to exit sensor, refined as items exit
+#define TIP_DELAY		150	// ms of belt travel from exit sensor until an item tips off
+#define FALL_DELAY		100	// ms from tipping off the belt to landing in the dish
+#define QUARTER_TURN_DELAY	10	// ms the dish settles after a turn before an item lands
 #define HALF_TURN_DELAY		100	// ms
 #define REVERSAL_DELAY		220	// ms
-#define EXIT_INT_DELAY		4000	// Divide by 125 to get ms
+#define DISH_PROFILE		PROFILE_FAST	// Acceleration profile at power up
+#define DISH_MODE		MOTION_FULL	// Stepper drive mode at power up
+#define HOME_STEP_TIME		12	// ms per full step on the final approach to the homing sensor
+#define HOME_BACKOFF		3	// Full steps back from the sensor before the final approach
+#define BLEND_SLACK		8	// Full steps the dish may be past a bin's centre when an item lands
+#define EXIT_WINDOW		60	// ms of belt travel either side of an item's predicted exit edge
+#define EXIT_EDGES		8	// Exit sensor edges waiting for the dish task, power of two
+#define RAMP_DOWN_TIME		8400	// ms
+#define RAMP_PERIOD		10	// ms between ramp down checks
+#define DISH_PERIOD		1	// ms between dish checks, sooner on an exit edge
+#define DISPLAY_PERIOD		100	// ms between screen updates
+#define SCREEN_TIME		2000	// ms each end of run or error screen is shown
+#define TELEMETRY_PERIOD	500	// ms between telemetry frames
+#define PARAM_PERIOD		100	// ms between retries of owed answers and waiting changes, sooner on a line end
+#define TRACE_PERIOD		100	// ms between checks for a fault to dump, sooner while a dump is sent
+
+// Main loop tasks, highest priority first
+#define TASK_BUTTONS		0
+#define TASK_CLASSIFY		1
+#define TASK_DISH		2
+#define TASK_BELT		3
+#define TASK_RAMP		4
+#define TASK_DISPLAY		5
+#define TASK_TRACE		6
+#define TASK_TELEMETRY		7
+#define TASK_PARAMS		8
+#endif
+
+#ifdef CALIBRATION_MODE
+#define CALIBRATION_RUNS	12	// Items of one class measured
 #endif
 
 #ifdef TIMER_CALIBRATION_MODE
 #define NO_ITEM_TIME		5000	// Divide by 125 to get ms
-#define AMBIENT_DEVIANCE	8	// Sensor value +/- due to ambient lighting
 #endif
 
 #ifdef EXIT_CALIBRATION_MODE
-volatile int is_double_count = 0;
+uint32_t last_edge = 0;		// Clock at the previous exit sensor edge
+#endif
+
+#ifdef TUNING_MODE
+#define TUNE_REST		100	// ms the dish stands between test moves
+#define TUNE_LIMIT		800	// Largest % of the fast preset tried
+#define TUNE_MARGIN		90	// % of the fastest reliable profile kept
+#define TUNE_ACCEL		0	// Search acceleration and jerk together
+#define TUNE_CRUISE		1	// Search the cruise rate
+
+// Run the test moves with a profile and say whether the dish kept its place
+char tune_trial(const profile_params *params);
+uint16_t tune_search(const profile_params *base, char what);
+profile_params tune_scale(const profile_params *base, char what, uint16_t percent);
 #endif
 
 // ADC conversion result
@@ -52,106 +109,294 @@ volatile unsigned int ADC_result;
 // State
 volatile int ADC_result_flag = 0;
 volatile int inbound = 0;
-volatile int running = 1;
-volatile int ramp_down = 0;
+int running = 1;
+int ramp_down = 0;
 volatile int finishing = 0;
-volatile int exiting = 0;
+uint32_t ramp_started;
+
+// Items between the optic sensor and the end of the belt
+queue item_queue;
 
 // Tracks number of items sorted
 volatile unsigned int plastic = 0;
 volatile unsigned int steel = 0;
 volatile unsigned int alum = 0;
+volatile unsigned int white = 0;	// Plastic by colour, for telemetry
+volatile unsigned int black = 0;
+
+// Id for the next item queued, never TRACE_NONE
+uint8_t next_id = 0;
+
+// Items landed in the dish and their time from the optic sensor, between
+// the first item's arrival and the last landing
+uint32_t first_seen;
+uint32_t last_landed;
+unsigned int landed = 0;
+uint32_t latency_total_ms = 0;
+uint16_t latency_max_ms = 0;
+
+// Dish scheduling
+char at_exit = 0;		// Head item is waiting at the exit sensor
+char held_at_exit = 0;		// ... and the belt is stopped for it
+char dropping = 0;		// Released item has not landed yet
+char tipped = 0;		// ... but it has left the belt
+char turning = 0;		// Dish move in progress
+uint32_t exit_travel;		// Belt travel when the head item reached the exit sensor
+uint32_t exit_lag_max = 0;	// Longest the dish task took to see an exit edge, clock ticks
+uint32_t exit_transit;		// Optic to exit sensor clock time of the last item
+uint32_t drop_travel;		// Belt travel when the dropping item reached the exit sensor
+uint8_t drop_id;		// ... and its id
+uint32_t drop_seen;		// ... and clock when it reached the optic sensor
+uint32_t tip_time;		// Clock when the dropping item left the belt
+uint32_t settle_ticks;		// Settling time owed by the current dish move
+uint32_t settle_until;		// Clock when the dish has settled after its last move
+uint32_t transit = CLOCK_MS(EXIT_TRANSIT);
+
+// Exit sensor edges, clock and belt odometer stamped by ISR(INT4_vect),
+// oldest first. The ISR is the only producer and the dish task the only
+// consumer, which turns the reading into travel.
+typedef struct exit_edge{
+	uint32_t time;
+	uint32_t travel;
+} exit_edge;
+volatile exit_edge exit_edges[EXIT_EDGES];
+volatile uint8_t exit_edges_in = 0;
+volatile uint8_t exit_edges_out = 0;
+
+// Exit edges outside the head item's window, or lost to a full queue, and
+// items whose window closed without an edge
+unsigned int spurious_edges = 0;
+volatile unsigned int lost_edges = 0;
+unsigned int unseen_exits = 0;
+
+// Exit events the dish was ready for, and ones that stopped the belt
+unsigned int stops_avoided = 0;
+unsigned int stops_forced = 0;
+
+// Dish acceleration profile and drive mode. Set profile_wanted or
+// mode_wanted at any time; the profile is rebuilt before the next move
+// starts.
+profile dish_profile;
+uint16_t profile_wanted = DISH_PROFILE;
+uint8_t profile_used = PROFILES;
+uint16_t mode_wanted = DISH_MODE;
+
+// Run-time copies of the system parameters, changed over serial and
+// applied between items. BELT_SPEED stays the reference duty that belt
+// travel is counted in; belt_cruise only sets what the belt runs at.
+uint16_t no_item_margin = NO_ITEM_MARGIN;
+uint16_t belt_cruise = BELT_SPEED;
+uint16_t belt_min = BELT_MIN;
+uint16_t belt_max = BELT_MAX;
+uint16_t govern_depth = GOVERN_DEPTH;
+uint16_t tip_delay = TIP_DELAY;
+uint16_t fall_delay = FALL_DELAY;
+uint16_t blend_slack = BLEND_SLACK;
+uint16_t exit_window = EXIT_WINDOW;
+
+void use_margin(void);
+char belt_order(const param *p, uint16_t value);
+
+// Limits are what the hardware allows, not what is sure to sort well:
+// tip_delay and fall_delay are properties of the line and are set to
+// match it. Belt speeds are duty cycles and also kept in order.
+const param params[] =
+{
+	{ "no_item_margin",	&no_item_margin,		1, 100,		0,		use_margin },
+	{ "belt_cruise",	&belt_cruise,			10, 100,	belt_order,	0 },
+	{ "belt_min",		&belt_min,			10, 100,	belt_order,	0 },
+	{ "belt_max",		&belt_max,			10, 100,	belt_order,	0 },
+	{ "govern_depth",	&govern_depth,			1, QUEUE_SIZE,	0,		0 },
+	{ "tip_delay",		&tip_delay,			0, 1000,	0,		0 },
+	{ "fall_delay",		&fall_delay,			0, 1000,	0,		0 },
+	{ "quarter_settle",	&turn_settle_ms[TURN_QUARTER],	0, 1000,	0,		0 },
+	{ "half_settle",	&turn_settle_ms[TURN_HALF],	0, 1000,	0,		0 },
+	{ "reversal_settle",	&turn_settle_ms[TURN_REVERSAL],	0, 1000,	0,		0 },
+	{ "blend_slack",	&blend_slack,			0, 50,		0,		0 },
+	{ "exit_window",	&exit_window,			10, 500,	0,		0 },
+	{ "dish_profile",	&profile_wanted,		0, PROFILES - 1, 0,		0 },
+	{ "dish_mode",		&mode_wanted,			MOTION_FULL, MOTION_HALF, 0,	0 },
+};
+
+// Dish moves under the current profile, planned against measured time in ms
+uint16_t move_expected_ms;	// Last move
+uint16_t move_actual_ms;
+uint32_t moves_expected_ms = 0;	// All moves
+uint32_t moves_actual_ms = 0;
+unsigned int moves = 0;
+char move_blended = 0;		// Current move was extended on the fly
+
+// Moves started before the previous item had landed, and the ms that
+// saved against waiting for it to land and starting from rest
+unsigned int blends = 0;
+unsigned int blends_extended = 0;	// ... by extending a move still under way
+uint32_t blend_saved_ms = 0;
+
+// Least certain classification of the run, % margin over the next class,
+// and items classified with less than CLASSIFY_SURE
+uint8_t confidence_min = 100;
+unsigned int doubtful = 0;
+
+// No-item baseline over the run, as items arrived
+uint16_t baseline_low = 0xFFFF;
+uint16_t baseline_high = 0;
+
+// Measurement windows, clock ticks
+uint32_t window_last = 0;
+uint32_t window_longest = 0;
+uint32_t windows_total = 0;
+unsigned int windows = 0;
+
+// Slip found by the homing sensor as the dish passes black
+volatile unsigned int slips = 0;
+volatile unsigned int slipped_steps = 0;	// Motor steps, all corrected
+char rehoming = 0;		// Dish lost its place and is seeking home
+unsigned int rehomes = 0;
+
+// Display
+const char *exit_label = "";	// Class of the last item at the exit sensor
+char complete = 0;		// Ramp down has finished
+uint32_t completed_at;
+
+// Startup homing time, and the part of it spent on the final approach, ms
+uint16_t homing_ms;
+uint16_t approach_ms;
 
 // Millisecond timer
 void mTimer(int count);
 
+// Act on button presses queued by their ISRs
+void handle_events(void);
+void print_latency(void);
+void print_edges(void);
+void print_exits(void);
+
+// Worst delay from a timer event to its ISR starting, us
+volatile uint16_t step_latency_max = 0;
+volatile uint16_t tick_latency_max = 0;
+
+// Classify finished measurements and queue the items
+void classify_items(void);
+void admit_item(const measurement *m);
+void print_classes(void);
+void print_windows(void);
+void print_ambient(void);
+
+// Turn the dish ahead of items and release them off the end of the belt
+void schedule_dish(void);
+char exit_edge_next(exit_edge *e);
+uint32_t exit_due(void);
+void reach_exit(uint32_t time, uint32_t travel);
+void print_stops(void);
+void print_moves(void);
+void print_blends(void);
+void print_slips(void);
+void print_homing(void);
+void rehome(void);
+void home_wait(void);
+
+// How sure the classifier was, and items that came touching another
+void print_classes(){
+	LCDClear();
+	LCDWriteStringXY(0,0, "Least sure %:");
+	LCDWriteIntXY(13,0,confidence_min,3);
+	LCDWriteStringXY(0,1, "Doubtful:");
+	LCDWriteIntXY(9,1,doubtful,3);
+	LCDWriteStringXY(12,1, "T:");
+	LCDWriteIntXY(14,1,measure_splits,2);
+}
+
+// Measurement window per item, averaged and longest
+void print_windows(){
+	LCDClear();
+	LCDWriteStringXY(0,0, "Window ms:");
+	LCDWriteIntXY(12,0,windows ? windows_total / windows / CLOCK_MS(1) : 0,4);
+	LCDWriteStringXY(0,1, "Longest ms:");
+	LCDWriteIntXY(12,1,window_longest / CLOCK_MS(1),4);
+}
+
+// No-item reflectance now and the range it drifted over
+void print_ambient(){
+	LCDClear();
+	LCDWriteStringXY(0,0, "Baseline:");
+	LCDWriteIntXY(12,0,measure_baseline(),4);
+	LCDWriteStringXY(0,1, "Range:");
+	LCDWriteIntXY(7,1,baseline_low,4);
+	LCDWriteStringXY(12,1, "-");
+	LCDWriteIntXY(13,1,baseline_high - baseline_low,3);
+}
+
+// Set the belt speed from queue depth and the dish's next deadline
+void govern_belt(void);
+void print_belt(void);
+
+// End the run once ramp down has timed out and the belt is clear
+void supervise_ramp(void);
+
+// Redraw the screen from the current state
+void update_display(void);
+void draw_display(void);
+
+// Send a telemetry frame with the run so far
+void report_telemetry(void);
+
+// Answer serial commands and apply parameter changes between items
+void tune_params(void);
+
+// Dump the trace after a fault, and feed any dump to the UART
+void send_trace(void);
+void print_wcet(uint8_t first);
+
+// Build the wanted acceleration profile and cost the planner's turns with it
+void use_profile(void);
+char profile_stale(void);
+
 int main(int argc, char* argv[])
 {	
-	// Initialize clock, LCD and queue
-	CLKPR = 0x80;
-	CLKPR = 0x01;
+	// Initialize clock, IO, timers, ADC, LCD and queue
+	hal_init();
 	InitLCD(LS_BLINK|LS_ULINE);
 	LCDClear();
-	link* newItem;
-	link* head;
-	link* tail;
-	link* oldItem;
-	setup(&head, &tail);
-	unsigned num_items = 0;
-		
-	// IO
-	DDRB = 0x80;
-	DDRL = 0xF0;
-	PORTL |= 0x70;
-	DDRA = 0xFF;
-	DDRC = 0xFF;
-	DDRK = 0xFF;
-	DDRF = 0xC0;
-	
-	// 8.4s ramp down countdown timer
-	TCCR5B |= _BV(WGM52);
-	TCCR5B |= _BV(CS52) | _BV(CS50);
-	OCR5A = 0xFFFF;
-	
-	// Set exit timer to CTC mode, 125kHz
-	TCCR4B |= _BV(WGM42);
-	TCCR4B |= _BV(CS41) | _BV(CS40);
-	#ifndef EXIT_CALIBRATION_MODE
-	OCR4A = EXIT_INT_DELAY;
-	#else
-	OCR4A = 0xFFFF;
-	#endif
+	hal_timer_ovf_enable(HAL_TIMER_PWM);
+	hal_uart_init();
+	setup(&item_queue);
 	
-	// Set ADC conversion timer to CTC mode, 125kHz
-	TCCR3B |= _BV(WGM32);
-	TCCR3B |= _BV(CS31) | _BV(CS30);
+	// ADC conversion timer
 	#ifdef TIMER_CALIBRATION_MODE
-	OCR3A = 0xFFFF;
-	#else
-	OCR3A = ADC_STOPWATCH;
+	hal_timer_set_top(HAL_TIMER_ADC, 0xFFFF);
 	#endif
-
-	// 1MHz millisecond timer counter
-	TCCR2A |= _BV(WGM21);
-	TCCR2B |= _BV(CS21) | _BV(CS20);
-	OCR2A = 250;
 	
-	// Auxiliary conversion timer
-	TCCR1B |= _BV(CS11) | _BV(CS10);
-	TCCR1B |= _BV(WGM12);
-	OCR1A = ROLLOFF_DELAY*125;
+	// System clock and belt PWM
+	clock_init();
+	belt_init(BELT_SPEED);
 	
-	// 3.9kHz PWM
-	TCCR0A |= _BV(WGM01) | _BV(WGM00);
-	OCR0A = BELT_SPEED * 255 / 100;
-	TCCR0A |= _BV(COM0A1);
-	TCCR0B |= _BV(CS01);
-
-	// Enable ADC with automatic interrupts after conversion success
-	ADCSRA |= _BV(ADEN);
-	ADCSRA |= _BV(ADIE);
-	ADMUX |=_BV(REFS0);
+	// Dish cost model for the rotation planner, with the tuned profile if
+	// there is one
+	if(profile_load(&profile_presets[PROFILE_TUNED])) profile_wanted = PROFILE_TUNED;
+	use_profile();
+	turn_settle_ms[TURN_QUARTER] = QUARTER_TURN_DELAY;
+	turn_settle_ms[TURN_HALF] = HALF_TURN_DELAY;
+	turn_settle_ms[TURN_REVERSAL] = REVERSAL_DELAY;
 	
 	// Enter uninterruptable command sequence
 	cli();
 	
-	// Set INT0 to any edge mode (kill switch)
-	// Set INT1 to rising edge mode (pause resume)
-	EICRA |= _BV(ISC00) | _BV(ISC10) | _BV(ISC11);
-	EIMSK |= _BV(INT0) | _BV(INT1);
+	// Enable INT0 (kill switch) and INT1 (pause resume)
+	hal_extint_enable(HAL_INT_KILL);
+	hal_extint_enable(HAL_INT_PAUSE);
 	
 	// Do continuous ADC conversions and keep smallest value on screen
 	#ifdef PRECALIBRATION_MODE
 	sei();
-	ADCSRA |= _BV(ADSC);
-	while(!ADC_result_flag);
+	hal_adc_start();
+	while(!ADC_result_flag) hal_idle();
 	ADC_result_flag = 0;
 	mTimer(2000);
 	unsigned no_item_value = 0xFFFF;
 	while(1)
 	{
-		ADCSRA |= _BV(ADSC);
-		while(!ADC_result_flag);
+		hal_adc_start();
+		while(!ADC_result_flag) hal_idle();
 		ADC_result_flag = 0;
 		LCDClear();
 		if(ADC_result < no_item_value) no_item_value = ADC_result;
@@ -160,45 +405,50 @@ int main(int argc, char* argv[])
 	}
 	#endif
 
-	// Set INT5 to rising edge mode (first optical sensor)
-	EICRB |= _BV(ISC51) | _BV(ISC50);
-	EIMSK |= _BV(INT5);
+	// Enable INT5 (first optical sensor)
+	hal_extint_enable(HAL_INT_OPTIC);
 	
-	// Run item through sensors 12 times and print minimum and maximum values
+	// Run items of one class through the sensor 12 times and print the
+	// mean and spread of every feature classify() compares, to refit its
+	// centroids from
 	#ifdef CALIBRATION_MODE
 	sei();
-	ADCSRA |= _BV(ADSC);
-	while(!ADC_result_flag);
-	ADC_result_flag = 0;
-	unsigned current_value;
-	unsigned low_value = 0xFFFF;
-	unsigned high_value = 0x0000;
+	measure_init(no_item_margin);
+	static const char *feature_names[CLASSIFY_FEATURES] = { "Min", "Depth", "Length", "Slope" };
+	int16_t runs[CALIBRATION_RUNS][CLASSIFY_FEATURES];
+	measurement reading;
 	LCDWriteStringXY(0,0,"Run Item 12x:");
-	for(int j = 0; j < 12; j++)
+	for(int j = 0; j < CALIBRATION_RUNS; j++)
 	{
-		current_value = 1337;
-		while(!inbound);
-		inbound = 0;
+		while(!measure_collect(&reading)) hal_idle();
+		classify_features(&reading, runs[j]);
 		LCDWriteIntXY(14,0,(j+1),2);
-		TCNT3 = 0x0000;
-		TIFR3 |= _BV(OCF3A);
-		while(!(TIFR3 & _BV(OCF3A)))
+		LCDWriteIntXY(6,1,runs[j][CLASSIFY_MIN],4);
+	}
+	for(int i = 0; i < CLASSIFY_FEATURES; i++)
+	{
+		int32_t sum = 0;
+		for(int j = 0; j < CALIBRATION_RUNS; j++) sum += runs[j][i];
+		int16_t mean = sum / CALIBRATION_RUNS;
+		
+		// Standard deviation, never less than 1 as the table needs
+		uint32_t variance = 0;
+		for(int j = 0; j < CALIBRATION_RUNS; j++)
 		{
-			ADCSRA |= _BV(ADSC);
-			while(!ADC_result_flag);
-			ADC_result_flag = 0;
-			if(ADC_result < current_value) current_value = ADC_result;
+			int32_t d = runs[j][i] - mean;
+			variance += (uint32_t)(d * d) / CALIBRATION_RUNS;
 		}
-		LCDWriteIntXY(6,1,current_value,4);
-		if(current_value < low_value) low_value = current_value;
-		if(current_value > high_value) high_value = current_value;
+		uint16_t spread = 1;
+		while((uint32_t)(spread + 1) * (spread + 1) <= variance) spread++;
+		
+		LCDClear();
+		LCDWriteStringXY(0,0,feature_names[i]);
+		LCDWriteStringXY(6,0,"Mean:");
+		LCDWriteIntXY(11,0,mean,5);
+		LCDWriteStringXY(0,1,"Spread:");
+		LCDWriteIntXY(11,1,spread,5);
+		mTimer(5000);
 	}
-	LCDClear();
-	LCDWriteStringXY(0,0,"Results:");
-	LCDWriteIntXY(0,1,low_value,4);
-	LCDWriteStringXY(5,1,"to");
-	LCDWriteIntXY(8,1,high_value,4);
-	mTimer(5000);
 	return(0);
 	#endif
 
@@ -208,26 +458,25 @@ int main(int argc, char* argv[])
 	LCDWriteStringXY(0,0,"TimerCalibration");
 	LCDWriteStringXY(0,1,"Items Seen:");
 	LCDWriteIntXY(14,1,0,2);
-	ADCSRA |= _BV(ADSC);
-	while(!ADC_result_flag);
+	hal_adc_start();
+	while(!ADC_result_flag) hal_idle();
 	ADC_result_flag = 0;
 	mTimer(1000);
 	unsigned timer_values[10]; 
 	for(int i = 0; i < 10; i++)
 	{
 		inbound = 0;
-		while(!inbound);
-		TCNT3 = 0x0000;
-		TIFR3 |= _BV(OCF3A);
+		while(!inbound) hal_idle();
+		hal_timer_restart(HAL_TIMER_ADC);
 		LCDWriteIntXY(14,1,(i+1),2);
-		ADCSRA |= _BV(ADSC);
-		while(!ADC_result_flag);
+		hal_adc_start();
+		while(!ADC_result_flag) hal_idle();
 		unsigned no_item_time = 0;
 		while(no_item_time < NO_ITEM_TIME)
 		{
 			ADC_result_flag = 0;
-			ADCSRA |= _BV(ADSC);
-			while(!ADC_result_flag);
+			hal_adc_start();
+			while(!ADC_result_flag) hal_idle();
 			if(ADC_result >= NO_ITEM_THRESHOLD - AMBIENT_DEVIANCE)
 			{
 				no_item_time++;
@@ -237,7 +486,7 @@ int main(int argc, char* argv[])
 				no_item_time = 0;
 			}
 		}
-		timer_values[i] = TCNT3;
+		timer_values[i] = hal_timer_count(HAL_TIMER_ADC);
 	}
 	unsigned low_value = timer_values[0];
 	unsigned high_value = low_value;
@@ -259,508 +508,613 @@ int main(int argc, char* argv[])
 	return(0);
 	#endif
 	
-	// Set INT2 to falling edge mode (homing sensor)
-	// Set INT3 to falling edge mode (ramp down)
-	// Set INT4 to falling edge mode (item at end of belt)
-	EICRA |= _BV(ISC21) | _BV(ISC31);
-	EICRB |= _BV(ISC41);
-	EIMSK |= _BV(INT2) | _BV(INT3) | _BV(INT4);
+	// Enable INT2 (homing sensor), INT3 (ramp down) and INT4 (item at end
+	// of belt)
+	hal_extint_enable(HAL_INT_HOME);
+	hal_extint_enable(HAL_INT_RAMP);
+	hal_extint_enable(HAL_INT_EXIT);
 	sei();
 	
 	// Prepare ADC, stepper and LCD
-	ADCSRA |= _BV(ADSC);
-	while(!ADC_result_flag);
-	ADC_result_flag = 0;
+	measure_init(no_item_margin);
+	motion_init();
 	home();
-	unsigned sensor_value;
+	
+	// Find the fastest profile the dish follows without losing steps and
+	// store it for sorting to use
+	#ifdef TUNING_MODE
+	belt_stop();
+	profile_params tuned = profile_presets[PROFILE_FAST];
 	LCDClear();
-	LCDWriteStringXY(0,0,"Sorting...");
+	LCDWriteStringXY(0,0,"Tuning accel");
+	tuned = tune_scale(&tuned, TUNE_ACCEL, tune_search(&tuned, TUNE_ACCEL));
+	LCDClear();
+	LCDWriteStringXY(0,0,"Tuning cruise");
+	tuned = tune_scale(&tuned, TUNE_CRUISE, tune_search(&tuned, TUNE_CRUISE));
+	tuned = tune_scale(&tuned, TUNE_ACCEL, TUNE_MARGIN);
+	tuned = tune_scale(&tuned, TUNE_CRUISE, TUNE_MARGIN);
+	LCDClear();
+	if(tune_trial(&tuned))
+	{
+		profile_store(&tuned);
+		LCDWriteStringXY(0,0,"Tuned to/s:");
+		LCDWriteIntXY(12,0,tuned.cruise,4);
+		LCDWriteStringXY(0,1,"Accel/s2:");
+		LCDWriteIntXY(11,1,tuned.accel,5);
+	}
+	else
+	{
+		LCDWriteStringXY(0,0,"Tuning failed");
+	}
+	mTimer(5000);
+	return(0);
+	#endif
+	
+	// Everything from here on runs as tasks that never wait
+	sched_task(TASK_BUTTONS, "Btn", handle_events, 0);
+	sched_task(TASK_CLASSIFY, "Cls", classify_items, 0);
+	sched_task(TASK_DISH, "Dsh", schedule_dish, DISH_PERIOD);
+	sched_task(TASK_BELT, "Blt", govern_belt, GOVERN_PERIOD);
+	sched_task(TASK_RAMP, "Rmp", supervise_ramp, RAMP_PERIOD);
+	sched_task(TASK_DISPLAY, "Dsp", update_display, DISPLAY_PERIOD);
+	sched_task(TASK_TRACE, "Trc", send_trace, TRACE_PERIOD);
+	sched_task(TASK_TELEMETRY, "Tlm", report_telemetry, TELEMETRY_PERIOD);
+	param_table(params, sizeof(params) / sizeof(params[0]));
+	sched_task(TASK_PARAMS, "Prm", tune_params, PARAM_PERIOD);
+	sched_signal(TASK_DISPLAY);
 
 	// Main loop
 	while(1)
-	{	
-		// If ramp-down mode is active, wait for currently enqueued items to
-		// be processed then exit
-		if(finishing)
-		{
-			LCDClear();
-			if(isEmpty(&head)){
-				LCDWriteStringXY(0,0,"Ramping down...");
-				LCDWriteStringXY(0,1,"complete.");
-				PORTL |= 0xF0;
-				mTimer(2000);
-				print_results();
-				while(1);
-			}
-		}
+	{
+		// Yield to the simulator on host builds; no-op on the target
+		hal_idle();
 		
-		// If paused, print sorting info
-		if(!running)
+		sched_run();
+	}
+	
+	return(0);
+}
+
+// Delay for 'count' milliseconds
+void mTimer(int count)
+{
+	// Set timer to CTC mode at 1MHz with TOP = 1000
+	int i = 0;
+	hal_timer_restart(HAL_TIMER_MS);
+
+	// Count to 1000 at 1MHz 'count' times
+	while(i < count)
+	{
+		if(hal_timer_expired(HAL_TIMER_MS))
 		{
-			print_results();
-			while(!running);
-			LCDClear();
+			hal_timer_clear(HAL_TIMER_MS);
+			i++;
 		}
-		
-		// Process item in front of reflective sensor
-		if(inbound)
+		else
 		{
-			// Reset values and start timer
-			sensor_value = 1337;
-			TCNT3 = 0x0000;
-			TIFR3 |= _BV(OCF3A);
-			
-			// Determine item value
-			while(!(TIFR3 & _BV(OCF3A)))
-			{
-				// Do a conversion; save result if less than current minimum
-				ADCSRA |= _BV(ADSC);
-				while(!ADC_result_flag);
-				ADC_result_flag = 0;
-				if(ADC_result < sensor_value) sensor_value = ADC_result;
-			}
-			
-			// Keep converting if optic sensor is still outputting logic low
-			while(PINE & _BV(PINE5))
-			{
-				// Do a conversion; save result if less than current minimum
-				ADCSRA |= _BV(ADSC);
-				while(!ADC_result_flag);
-				ADC_result_flag = 0;
-				if(ADC_result < sensor_value) sensor_value = ADC_result;
-			}
-			
-			// Add item to queue
-			initLink(&newItem);
-			LCDClear();
-			if(sensor_value < ALUMINIUM_MAX)
-			{
-				newItem->itemType = 'a';
-				//LCDWriteStringXY(0,1,"Alum");
-			}
-			else if(sensor_value < STEEL_MAX)
-			{
-				newItem->itemType = 's';
-				//LCDWriteStringXY(0,1,"Steel");
-			}
-			else if(sensor_value < WHITE_MAX)
-			{
-				newItem->itemType = 'w';
-				//LCDWriteStringXY(0,1,"White");
-			}
-			else
-			{
-				newItem->itemType = 'b';
-				//LCDWriteStringXY(0,1,"Black");
-			}
-			enqueue(&head,&tail,&newItem);
-			num_items++;
-			if(ramp_down)
-			{
-				LCDWriteStringXY(0,0,"Ramping down...");
-			}
-			else
-			{
-				LCDWriteStringXY(0,0,"Sorting...");
-				LCDWriteIntXY(14,0,num_items,2);
-			}
-
-			// Update state
-			inbound = 0;
+			hal_idle();
 		}
+	}
+	
+	return;
+}
 
-		if(exiting)
+void handle_events(void)
+{
+	event e;
+	
+	while(event_next(&e))
+	{
+		switch(e.type)
 		{
-			// Save conversion timer value
-			//unsigned tmp;
-			//if(inbound) tmp = TCNT3;
-		
-			#ifndef EXIT_CALIBRATION_MODE
-			
-			// Mask this interrupt
-			EIMSK &= ~_BV(INT4);
-			
-			#else
-			
-			// Capture timer value
-			unsigned double_count_time = TCNT4;
-			
-			// If double-count, print time between counts
-			if(is_double_count)
+			case EVENT_PAUSE:
+			if(running)
 			{
-				LCDClear();
-				LCDWriteStringXY(1,0,"DOUBLE TROUBLE");
-				LCDWriteIntXY(5,1,double_count_time,5);
-				mTimer(2000);
+				// Pause, and send the trace while nothing moves
+				belt_hold(1);
+				motion_hold(1);
+				running = 0;
+				trace(TRACE_PAUSE, TRACE_NONE, 1);
+				trace_dump();
+				sched_signal(TASK_TRACE);
 			}
 			else
 			{
-				LCDClear();
-				LCDWriteStringXY(0,0,"Sorting...");
-				LCDWriteIntXY(14,0,num_items,2);
-				is_double_count = 1;
+				// Resume
+				belt_hold(0);
+				motion_hold(0);
+				running = 1;
+				trace(TRACE_PAUSE, TRACE_NONE, 0);
 			}
+			sched_signal(TASK_DISPLAY);
+			break;
 			
-			#endif
-			
-			// Stop the belt
-			PORTL |= 0xF0;
-			
-			// Print info
-			switch(firstValue(&head))
+			case EVENT_RAMP:
+			if(!ramp_down)
 			{
-				case 'a':
-				LCDWriteStringXY(0,1,"Aluminium       ");
-				alum++;
-				break;
-				
-				case 's':
-				LCDWriteStringXY(0,1,"Steel           ");
-				steel++;
-				break;
-				
-				case 'b':
-				LCDWriteStringXY(0,1,"Black Plastic   ");
-				plastic++;
-				break;
-				
-				case 'w':
-				LCDWriteStringXY(0,1,"White Plastic   ");
-				plastic++;
-				break;
-			}
-		
-			// Move the stepper dish
-			int turn_type = sort(firstValue(&head));
-			num_items--;
-		
-			// Remove the item from the queue
-			dequeue(&head, &tail, &oldItem);
-			destroyLink(&oldItem);
-			
-			// Delay appropriately
-			switch(turn_type)
-			{
-				case 0:
-					mTimer(NO_TURN_DELAY);
-					break;
-				case 1:
-					mTimer(QUARTER_TURN_DELAY);
-					break;
-				case 2:
-					mTimer(HALF_TURN_DELAY);
-					break;
-				case 3:
-					mTimer(REVERSAL_DELAY);
-					break;
+				ramp_started = e.time;
+				ramp_down = 1;
+				trace_at(TRACE_RAMP, TRACE_NONE, 0, e.time);
+				sched_signal(TASK_DISPLAY);
 			}
+			break;
+		}
+	}
+}
+
+// Find black in two stages. A seek at the full profile finds the sensor
+// and brakes past it, the dish backs off to a few steps short of it, then
+// steps slowly clockwise until INT2 fires so the edge is caught at the
+// same speed and from the same side every time.
+void home(){
+	uint32_t started = clock_now();
 	
-			// Print info
-			if(!ramp_down) LCDWriteIntXY(14,0,num_items,2);
-			
-			// Start the exit timer and enable its interrupt
-			TCNT4 = 0x0000;
-			TIFR4 |= _BV(OCF4A);
-			TIMSK4 |= _BV(OCIE4A);
-			
-			// Update state
-			exiting = 0;
-					
-			// Resume the belt
-			PORTL &= 0x7F;
-			
-			// Ensure new conversions still carried out while
-			// item rolls of belt
-			TCNT1 = 0x0000;
-			TIFR1 |= _BV(OCF1A);
-			while(!(TIFR1 & _BV(OCF1A)))
+	// Seek, a turn and a quarter is sure to pass the sensor
+	while (!homed_flag){
+		motion_start(CW, MOTION_REV + QUARTER_TURN, &dish_profile);
+		home_wait();
+	}
+	
+	// Back off; the move also takes back the overshoot
+	disk_direction = CCW;
+	motion_start(CCW, HOME_BACKOFF, &dish_profile);
+	home_wait();
+	
+	// Approach
+	uint32_t approached = clock_now();
+	homed_flag = 0;
+	disk_direction = CW;
+	while (!homed_flag){
+		home_wait();
+		motion_step(CW);
+		mTimer(HOME_STEP_TIME / motion_microsteps());
+	}
+	
+	homing_ms = (clock_now() - started) / CLOCK_MS(1);
+	approach_ms = (clock_now() - approached) / CLOCK_MS(1);
+}
+
+// Wait for the homing move in progress, if any, showing the results while
+// paused
+void home_wait(void){
+	do
+	{
+		handle_events();
+		if(!running)
+		{
+			print_results();
+			while(!running)
 			{
-				if(inbound)
-				{
-					// Reset values and start timer
-					sensor_value = 1337;
-					TCNT3 = 0x0000;
-					TIFR3 |= _BV(OCF3A);
-					
-					// Determine item value
-					while(!(TIFR3 & _BV(OCF3A)))
-					{
-						// Do a conversion; save result if less than current minimum
-						ADCSRA |= _BV(ADSC);
-						while(!ADC_result_flag);
-						ADC_result_flag = 0;
-						if(ADC_result < sensor_value) sensor_value = ADC_result;
-					}
-					
-					// Keep converting if optic sensor is still outputting logic low
-					while(PINE & _BV(PINE5))
-					{
-						// Do a conversion; save result if less than current minimum
-						ADCSRA |= _BV(ADSC);
-						while(!ADC_result_flag);
-						ADC_result_flag = 0;
-						if(ADC_result < sensor_value) sensor_value = ADC_result;
-					}
-					
-					// Add item to queue
-					initLink(&newItem);
-					LCDClear();
-					if(sensor_value < ALUMINIUM_MAX)
-					{
-						newItem->itemType = 'a';
-						//LCDWriteStringXY(0,1,"Alum");
-					}
-					else if(sensor_value < STEEL_MAX)
-					{
-						newItem->itemType = 's';
-						//LCDWriteStringXY(0,1,"Steel");
-					}
-					else if(sensor_value < WHITE_MAX)
-					{
-						newItem->itemType = 'w';
-						//LCDWriteStringXY(0,1,"White");
-					}
-					else
-					{
-						newItem->itemType = 'b';
-						//LCDWriteStringXY(0,1,"Black");
-					}
-					enqueue(&head,&tail,&newItem);
-					num_items++;
-					if(ramp_down)
-					{
-						LCDWriteStringXY(0,0,"Ramping down...");
-					}
-					else
-					{
-						LCDWriteStringXY(0,0,"Sorting...");
-						LCDWriteIntXY(14,0,num_items,2);
-					}
-
-					// Update state
-					inbound = 0;
-				}
+				handle_events();
+				hal_idle();
 			}
 		}
+		hal_idle();
 	}
+	while (motion_busy());
+}
+
+
+//This function starts the stepper on a planned turn
+void move(const plan *p){
+	disk_direction = p->direction;
+	motion_start(p->direction, p->steps, &dish_profile);
+}
+
+char profile_stale(void)
+{
+	return profile_used != profile_wanted || dish_profile.microsteps != mode_wanted;
+}
+
+// Only while the dish is idle, a move in progress reads dish_profile
+void use_profile(void)
+{
+	motion_mode(mode_wanted);
+	profile_build(&dish_profile, &profile_presets[profile_wanted], mode_wanted);
+	profile_used = profile_wanted;
+	turn_move_ms[TURN_QUARTER] = profile_move_us(&dish_profile, QUARTER_TURN) / 1000;
+	turn_move_ms[TURN_HALF] = profile_move_us(&dish_profile, HALF_TURN) / 1000;
 	
-	return(0);
+	// Move statistics are per profile
+	moves_expected_ms = 0;
+	moves_actual_ms = 0;
+	moves = 0;
 }
 
-// Delay for 'count' milliseconds
-void mTimer(int count)
+void classify_items(void)
 {
-	// Set timer to CTC mode at 1MHz with TOP = 1000
-	int i = 0;
-	TCNT2 = 0x00;
-	TIFR2 |= _BV(OCF2A);
+	static uint8_t overruns = 0;
+	static uint8_t timeouts = 0;
+	measurement reading;
+	
+	while(measure_collect(&reading)) admit_item(&reading);
+	
+	if(measure_overruns != overruns || measure_timeouts != timeouts)
+	{
+		overruns = measure_overruns;
+		timeouts = measure_timeouts;
+		trace_fault(FAULT_MEASURE_LOST);
+	}
+}
 
-	// Count to 1000 at 1MHz 'count' times
-	while(i < count)
+// Classify an item from its reflectance and add it to the queue
+void admit_item(const measurement *m)
+{
+	item newItem;
+	
+	// Where the belt was when the item reached the optic sensor
+	newItem.inbound = m->travel;
+	newItem.seen = m->start;
+	newItem.exited = 0;
+	if(windows == 0) first_seen = m->start;
+	newItem.id = next_id;
+	if(++next_id == TRACE_NONE) next_id = 0;
+	trace_at(TRACE_MEASURED, newItem.id, m->min, m->start + m->window);
+	
+	if(m->baseline < baseline_low) baseline_low = m->baseline;
+	if(m->baseline > baseline_high) baseline_high = m->baseline;
+	
+	window_last = m->window;
+	if(m->window > window_longest) window_longest = m->window;
+	windows_total += m->window;
+	windows++;
+	
+	uint8_t confidence;
+	newItem.itemType = classify(m, &confidence);
+	if(confidence < confidence_min) confidence_min = confidence;
+	if(confidence < CLASSIFY_SURE) doubtful++;
+	trace(TRACE_CLASS, newItem.id, (uint16_t)confidence << 8 | (uint8_t)newItem.itemType);
+	
+	if(enqueue(&item_queue, &newItem))
+	{
+		trace(TRACE_ENQUEUE, newItem.id, (clock_now() - m->start) / CLOCK_MS(1));
+	}
+	else
+	{
+		trace_fault(FAULT_QUEUE_FULL);
+	}
+	sched_signal(TASK_DISPLAY);
+}
+
+// Clock ticks until the dish has finished turning and settled
+uint32_t dish_ready_in(void)
+{
+	uint32_t now = clock_now();
+	
+	if(turning)
 	{
-		if(TIFR2 & _BV(OCF2A))
+		if(motion_busy()) return motion_remaining() / (1000000UL / CLOCK_HZ) + settle_ticks;
+		turning = 0;
+		settle_until = now + settle_ticks;
+		trace(TRACE_MOVE_END, TRACE_NONE, motion_last_us() / 1000);
+		
+		// Planned against measured move time, for moves planned in one go
+		if(!move_blended)
 		{
-			TIFR2 |= _BV(OCF2A);
-			i++;
+			move_actual_ms = motion_last_us() / 1000;
+			moves_expected_ms += move_expected_ms;
+			moves_actual_ms += move_actual_ms;
+			moves++;
 		}
 	}
+	if((int32_t)(settle_until - now) > 0) return settle_until - now;
+	return 0;
+}
+
+// Belt travel left before the head item tips off the end
+uint32_t tip_travel_left(void)
+{
+	uint32_t due = at_exit ? exit_travel : exit_due();
+	int32_t left = (int32_t)(due + CLOCK_MS(tip_delay) - belt_travel());
 	
-	return;
+	return left > 0 ? left : 0;
 }
 
-//This function rotates the stepper clockwise until the homing sensor triggers the INT2 interrupt
-void home(){
-	while (!homed_flag){
-		if(!running)
-		{
-			print_results();
-			while(!running);
-		}
-		
-		PORTA = stepper[position];
-		mTimer(11);
-		position++;
-		if(position == 4){
-			position = 0;
-		}
+// Clock ticks until the head item lands in the dish if the belt runs at
+// its current speed from now on, or at the reference speed if none is set
+uint32_t landing_deadline(void)
+{
+	uint8_t duty = belt_speed();
+	
+	if(!duty) duty = BELT_SPEED;
+	return tip_travel_left() * BELT_SPEED / duty + CLOCK_MS(fall_delay);
+}
+
+// Plan the dish turn toward the head item's bin, looking further down the
+// queue to pick directions. Returns 0 if the dish is already there.
+char plan_next(plan *p)
+{
+	char types[PLAN_LOOKAHEAD];
+	uint8_t n = 0;
+	
+	while(n < PLAN_LOOKAHEAD && n < size(&item_queue))
+	{
+		types[n] = peek(&item_queue, n)->itemType;
+		n++;
 	}
+	return plan_move(disk_location, disk_direction, types, n, p) && p->steps;
 }
 
+// Bookkeeping for a turn just started or added to the move under way
+void turn_started(const plan *p, char blended)
+{
+	disk_location = firstValue(&item_queue);
+	settle_ticks = CLOCK_MS(turn_settle_ms[p->turn]);
+	move_expected_ms = p->cost - turn_settle_ms[p->turn];
+	move_blended = blended;
+	turning = 1;
+	
+	int16_t steps = (p->direction == CW) ? p->steps : -(int16_t)p->steps;
+	trace(blended ? TRACE_EXTEND : TRACE_MOVE, peek(&item_queue, 0)->id, steps);
+}
 
-//This function moves the stepper clockwise(0) or counter clockwise(1) 90 degrees or 180 degrees
-void move(int c){
-	int i = 0;
-	int total = c;
-	if (disk_direction == 0){
-		while(c > 0){
-			if(!running)
-			{
-				print_results();
-				while(!running);
-			}
-			
-			PORTA = stepper[position];
-			if(total == 90){
-				mTimer(delay_a[i]);
-			}
-			else{mTimer(delay_b[i]);}
-			i++;		
-			position++;
-			c--;			
-			if(position == 4){
-				position = 0;
-			}
-			if(c == 0){
-		/*		LCDClear();
-				LCDWriteStringXY(0,1,"Position: ");
-				LCDWriteIntXY(11,1,position,2);				
-				mTimer(2000);*/
-				break;
-			}			
-		}
+// Start the planned turn from rest
+void preposition(void)
+{
+	plan p;
+	
+	if(profile_stale()) use_profile();
+	if(!plan_next(&p)) return;
+	
+	move(&p);
+	turn_started(&p, 0);
+}
+
+// A braked seek or slip found on the last move is made up on the next
+// one. If the next item goes to the same bin there is none, so the dish
+// turns back into place on its own.
+void correct_dish(void)
+{
+	int16_t steps = motion_owed();
+	
+	if(profile_stale()) use_profile();
+	if(!motion_correct(&dish_profile)) return;
+	
+	settle_ticks = CLOCK_MS(turn_settle_ms[TURN_QUARTER]);
+	move_blended = 1;
+	turning = 1;
+	trace(TRACE_MOVE, TRACE_NONE, steps);
+}
+
+// Once the dropping item has tipped off the belt its landing time is
+// known, so the dish need not wait for it to land before heading for the
+// next bin. The turn starts, or a move still braking into this bin carries
+// on in the same direction, as early as possible while still keeping the
+// dish within blend_slack steps of the bin until the item is in.
+void blend_next(void)
+{
+	plan p;
+	uint32_t now = clock_now();
+	uint32_t landing = tip_time + CLOCK_MS(fall_delay);
+	char busy = motion_busy();
+	
+	// A new profile is only built with the dish at rest
+	if(profile_stale()) return;
+	if(!plan_next(&p)) return;
+	
+	// Reversing needs the dish stopped first
+	if(busy && p.direction != disk_direction) return;
+	
+	// Too soon, the dish would be past the slack before the item lands
+	uint32_t leave = now + motion_reach_us(&dish_profile, p.steps, blend_slack) / (1000000UL / CLOCK_HZ);
+	if((int32_t)(leave - landing) < 0) return;
+	
+	if(busy)
+	{
+		if(!motion_extend(p.direction, p.steps)) return;
+		blends_extended++;
 	}
-	if (disk_direction == 1){
-		while (c > 0){
-			if(!running)
-			{
-				print_results();
-				while(!running);
-			}
-			
-			PORTA = stepper[position];
-			if(total == 90){
-				mTimer(delay_a[i]);
-			}
-			else{mTimer(delay_b[i]);}
-			i++;
-			position--;
-			c--;
-			if(position < 0){
-				position = 3;
-			}
-			if(c == 0){
-			/*	LCDClear();
-				LCDWriteStringXY(0,1,"Position: ");
-				LCDWriteIntXY(11,1,position,2);
-				mTimer(2000);*/
-				break;
-			}
-		}
+	else
+	{
+		move(&p);
 	}
+	turn_started(&p, busy);
+	
+	// Against starting from rest once the item has landed
+	uint32_t waited = landing + profile_move_us(&dish_profile, p.steps) / (1000000UL / CLOCK_HZ);
+	uint32_t arrives = now + motion_remaining() / (1000000UL / CLOCK_HZ);
+	if((int32_t)(waited - arrives) > 0) blend_saved_ms += (waited - arrives) / CLOCK_MS(1);
+	blends++;
 }
 
-// This function moves the sorting bucket to a location based on part in list
-int sort(char item)
+// Take the oldest exit sensor edge. Returns 0 if there is none.
+char exit_edge_next(exit_edge *e)
 {
-	if(item == 'E')
+	uint8_t out = exit_edges_out;
+	
+	if(out == exit_edges_in) return 0;
+	e->time = exit_edges[out & (EXIT_EDGES - 1)].time;
+	e->travel = belt_travel_at(exit_edges[out & (EXIT_EDGES - 1)].travel);
+	exit_edges_out = out + 1;
+	return 1;
+}
+
+// Belt travel at which the head item should reach the exit sensor
+uint32_t exit_due(void)
+{
+	return peek(&item_queue, 0)->inbound + transit;
+}
+
+// The head item is at the exit sensor, since clock 'time' and belt travel
+// 'travel'
+void reach_exit(uint32_t time, uint32_t travel)
+{
+	item *head = peek(&item_queue, 0);
+	
+	at_exit = 1;
+	exit_travel = travel;
+	head->exited = time;
+	exit_transit = time - head->seen;
+	
+	// Print info
+	switch(head->itemType)
 	{
-		// Error
-		LCDClear();
-		LCDWriteStringXY(5,0,"ERROR:");
-		LCDWriteStringXY(2,1,"Double Count");
-		mTimer(2000);
+		case 'a':
+		exit_label = "Aluminium";
+		alum++;
+		break;
+		
+		case 's':
+		exit_label = "Steel";
+		steel++;
+		break;
+		
+		case 'b':
+		exit_label = "Black Plastic";
+		plastic++;
+		black++;
+		break;
+		
+		case 'w':
+		exit_label = "White Plastic";
+		plastic++;
+		white++;
+		break;
 	}
+	sched_signal(TASK_DISPLAY);
+}
+
+// The dish is turned toward the next item's bin as soon as the previous one
+// has landed, while the belt keeps running. When the item reaches the exit
+// sensor the belt is only stopped if the dish cannot settle before the item
+// would land.
+void schedule_dish(void)
+{
+	item oldItem;
 	
-	items_sorted++;
+	// The dish and the belt stand still while paused
+	if(!running) return;
 	
-	int recent_disk_direction = disk_direction;
-	switch(disk_location)
+	// Notice the end of a dish move as soon as it happens
+	dish_ready_in();
+	
+	// Follow the released item off the belt and into the dish
+	if(dropping)
 	{
-		case 'b':
-		switch(item)
+		if(!tipped && belt_travel() - drop_travel >= CLOCK_MS(tip_delay))
 		{
-			case 'b':
-			return 0;
-			
-			case 'a':
-			disk_direction = 0;
-			move(QUARTER_TURN);
-			disk_location = 'a';
-			return (disk_direction ^ recent_disk_direction) ? 3 : 1;
-			
-			case 's':
-			disk_direction = 1;
-			move(QUARTER_TURN);
-			disk_location = 's';
-			return (disk_direction ^ recent_disk_direction) ? 3 : 1;
+			tipped = 1;
+			tip_time = clock_now();
+		}
+		if(tipped && clock_now() - tip_time >= CLOCK_MS(fall_delay))
+		{
+			dropping = 0;
+			trace(TRACE_LAND, drop_id, 0);
 			
-			case 'w':
-			move(HALF_TURN);
-			disk_location = 'w';
-			return 2;
+			last_landed = clock_now();
+			uint16_t ms = (last_landed - drop_seen) / CLOCK_MS(1);
+			latency_total_ms += ms;
+			if(ms > latency_max_ms) latency_max_ms = ms;
+			landed++;
 		}
+	}
+	
+	// A dish that has lost its place is homed again before anything else
+	if(rehoming || motion_lost())
+	{
+		rehome();
+		return;
+	}
+	
+	// Match exit sensor edges to the head item. An edge before its window
+	// opens is a bounce off the item before it or noise, and so is one
+	// while the head item is already at the exit.
+	exit_edge e;
+	while(exit_edge_next(&e))
+	{
+		#ifdef EXIT_CALIBRATION_MODE
 		
-		case 'a':
-		switch(item)
+		// If double-count, print time between counts
+		uint32_t gap = e.time - last_edge;
+		last_edge = e.time;
+		if(gap <= 0xFFFF)
 		{
-			case 'a':
-			return 0;
-			
-			case 'b':
-			disk_direction = 1;
-			move(QUARTER_TURN);
-			disk_location = 'b';
-			return (disk_direction ^ recent_disk_direction) ? 3 : 1;
-			
-			case 's':
-			move(HALF_TURN);
-			disk_location = 's';
-			return 2;
-			
-			case 'w':
-			disk_direction = 0;
-			move(QUARTER_TURN);
-			disk_location = 'w';
-			return (disk_direction ^ recent_disk_direction) ? 3 : 1;
+			LCDClear();
+			LCDWriteStringXY(1,0,"DOUBLE TROUBLE");
+			LCDWriteIntXY(5,1,gap,5);
+			mTimer(2000);
+		}
+		else
+		{
+			LCDClear();
+			LCDWriteStringXY(0,0,"Sorting...");
+			LCDWriteIntXY(14,0,size(&item_queue),2);
 		}
 		
-		case 'w':
-		switch(item)
+		#endif
+		
+		if(at_exit || isEmpty(&item_queue) || (int32_t)(e.travel - exit_due() + CLOCK_MS(exit_window)) < 0)
 		{
-			case 'w':
-			return 0;
-			
-			case 'b':
-			move(HALF_TURN);
-			disk_location = 'b';
-			return 2;
-			
-			case 'a':
-			disk_direction = 1;
-			move(QUARTER_TURN);
-			disk_location = 'a';
-			return (disk_direction ^ recent_disk_direction) ? 3 : 1;
-			
-			case 's':
-			disk_direction = 0;
-			move(QUARTER_TURN);
-			disk_location = 's';
-			return (disk_direction ^ recent_disk_direction) ? 3 : 1;
+			spurious_edges++;
+			continue;
 		}
+		uint32_t lag = clock_now() - e.time;
+		if(lag > exit_lag_max) exit_lag_max = lag;
 		
-		case 's':
-		switch(item)
+		// Refine the optic to exit travel estimate
+		int32_t error = (int32_t)(e.travel - exit_due());
+		transit += error / 8;
+		
+		reach_exit(e.time, e.travel);
+		trace_at(TRACE_ARRIVE, peek(&item_queue, 0)->id, 1, e.time);
+	}
+	
+	// An item touching the one before it gives no edge of its own. Once its
+	// window has closed it is taken to have arrived when predicted.
+	if(!at_exit && !isEmpty(&item_queue) && (int32_t)(belt_travel() - exit_due() - CLOCK_MS(exit_window)) >= 0)
+	{
+		unseen_exits++;
+		reach_exit(clock_now(), exit_due());
+		trace(TRACE_ARRIVE, peek(&item_queue, 0)->id, 0);
+	}
+	
+	// Turn toward the head item's bin once nothing is falling into the dish,
+	// or sooner if the falling item can no longer miss
+	if(!isEmpty(&item_queue) && firstValue(&item_queue) != disk_location)
+	{
+		if(!dropping && !motion_busy()) preposition();
+		else if(dropping && tipped) blend_next();
+	}
+	else if(!dropping && !motion_busy() && motion_owed())
+	{
+		correct_dish();
+	}
+	
+	if(!at_exit) return;
+	
+	if(firstValue(&item_queue) == disk_location && dish_ready_in() <= landing_deadline())
+	{
+		// Dish will be in place in time, let the item go
+		char stopped = held_at_exit;
+		if(held_at_exit)
 		{
-			case 's':
-			return 0;
-			
-			case 'b':
-			disk_direction = 0;
-			move(QUARTER_TURN);
-			disk_location = 'b';
-			return (disk_direction ^ recent_disk_direction) ? 3 : 1;
-			
-			case 'a':
-			move(HALF_TURN);
-			disk_location = 'a';
-			return 2;
-			
-			case 'w':
-			disk_direction = 1;
-			move(QUARTER_TURN);
-			disk_location = 'w';
-			return (disk_direction ^ recent_disk_direction) ? 3 : 1;
+			held_at_exit = 0;
+			belt_run();
 		}
+		else
+		{
+			stops_avoided++;
+		}
+		drop_id = peek(&item_queue, 0)->id;
+		drop_seen = peek(&item_queue, 0)->seen;
+		trace(TRACE_RELEASE, drop_id, stopped);
+		dequeue(&item_queue, &oldItem);
+		items_sorted++;
+		at_exit = 0;
+		dropping = 1;
+		tipped = 0;
+		drop_travel = exit_travel;
+		
+		sched_signal(TASK_DISPLAY);
+	}
+	else if(!held_at_exit && (!dropping || tipped))
+	{
+		// Hold the item at the end of the belt until the dish is ready. If
+		// the previous item is still on the belt it is further along, so
+		// the belt keeps running until that one has tipped off.
+		belt_stop();
+		held_at_exit = 1;
+		stops_forced++;
 	}
 }
 
@@ -777,229 +1131,564 @@ void print_results(){
 	LCDWriteIntXY(14,1,plastic,2);
 }
 
-void setup(link **h,link **t)
+// The belt runs faster the shorter the queue, and slows down instead of
+// stopping when the head item would otherwise land before the dish has
+// settled. Below belt_min the exit sensor hold takes over.
+void govern_belt(void)
 {
-	*h = NULL;
-	*t = NULL;
-	return;
+	uint8_t depth = size(&item_queue);
+	uint8_t target = belt_cruise;
+	
+	if(!running) return;
+	
+	if(depth < govern_depth)
+	{
+		target = belt_max - (int16_t)(belt_max - belt_cruise) * depth / (int16_t)govern_depth;
+	}
+	
+	// Slow down so the item the dish is turning for lands no sooner than
+	// the dish has settled. For a queued item that would need the belt
+	// below belt_min, keep going and let the exit sensor hold it instead;
+	// a released item is slowed as far as belt_min but no further, as a
+	// duty near 0 stalls the motor and the odometer with it. Once a
+	// released item has tipped off, the turn for the next one has not
+	// started yet; it is checked again when that turn begins.
+	int32_t left = -1;
+	if(dropping && !tipped)
+	{
+		left = (int32_t)(drop_travel + CLOCK_MS(tip_delay) - belt_travel());
+	}
+	else if(depth && !dropping && firstValue(&item_queue) == disk_location)
+	{
+		left = tip_travel_left();
+	}
+	if(left >= 0)
+	{
+		uint32_t ready = dish_ready_in();
+		if(ready > CLOCK_MS(fall_delay))
+		{
+			uint32_t limit = (uint32_t)left * BELT_SPEED / (ready - CLOCK_MS(fall_delay));
+			if(limit < target && (dropping || limit >= belt_min)) target = limit;
+		}
+	}
+	if(target < belt_min) target = belt_min;
+	
+	// Slow down at once, speed up gently
+	if(target > belt_speed() + GOVERN_SLEW) target = belt_speed() + GOVERN_SLEW;
+	belt_duty(target);
 }
 
-void initLink(link **newLink)
+void supervise_ramp(void)
 {
-	// Allocate new link
-	*newLink = malloc(sizeof(link));
-	(*newLink)->next = NULL;
-	return;
+	if(!ramp_down || complete) return;
+	
+	// Stop feeding once the ramp down time is up, then wait for the items
+	// already on the belt
+	if(!finishing && clock_now() - ramp_started >= CLOCK_MS(RAMP_DOWN_TIME))
+	{
+		finishing = 1;
+	}
+	if(finishing && isEmpty(&item_queue) && !dropping)
+	{
+		belt_stop();
+		trace(TRACE_DONE, TRACE_NONE, 0);
+		complete = 1;
+		completed_at = clock_now();
+		sched_signal(TASK_DISPLAY);
+	}
 }
 
-void destroyLink (link **oldLink)
+void draw_display(void)
 {
-	if(*oldLink != NULL) free(*oldLink);
-	return;
+	uint32_t now = clock_now();
+	
+	// After ramp down, step through the run's statistics and halt
+	if(complete)
+	{
+		switch((now - completed_at) / CLOCK_MS(SCREEN_TIME))
+		{
+			case 0:
+			LCDClear();
+			LCDWriteStringXY(0,0,"Ramping down...");
+			LCDWriteStringXY(0,1,"complete.");
+			break;
+			
+			case 1: print_results(); break;
+			case 2: print_classes(); break;
+			case 3: print_windows(); break;
+			case 4: print_ambient(); break;
+			case 5: print_stops(); break;
+			case 6: print_moves(); break;
+			case 7: print_blends(); break;
+			case 8: print_slips(); break;
+			case 9: print_homing(); break;
+			case 10: print_belt(); break;
+			case 11: print_latency(); break;
+			case 12: print_edges(); break;
+			case 13: print_exits(); break;
+			case 14: print_wcet(0); break;
+			case 15: print_wcet(4); break;
+			
+			default:
+			print_wcet(8);
+			LCDFlush();
+			trace_dump();
+			while(trace_send()) hal_idle();
+			uart_flush();
+			hal_halt();
+		}
+		return;
+	}
+	
+	// If paused, print sorting info
+	if(!running)
+	{
+		print_results();
+		return;
+	}
+	
+	LCDClear();
+	if(ramp_down)
+	{
+		LCDWriteStringXY(0,0,"Ramping down...");
+	}
+	else
+	{
+		LCDWriteStringXY(0,0,"Sorting...");
+		LCDWriteIntXY(11,0,window_last / CLOCK_MS(1),3);
+		LCDWriteIntXY(14,0,size(&item_queue),2);
+	}
+	LCDWriteStringXY(0,1,exit_label);
 }
 
-void enqueue(link **h, link **t, link **nL)
+// Drawn into a scratch screen and copied into the LCD framebuffer at once,
+// so the timer0 ISR never sends a screen half redrawn, and sends nothing
+// for cells that came out the same as before
+void update_display(void)
 {
-	if (*t != NULL){
-		// Queue not empty
-		(*t)->next = *nL;
-		*t = *nL;
-	}
-	else{
-		// Empty queue
-		*h = *nL;
-		*t = *nL;
-	}
+	LCDDraft();
+	draw_display();
+	LCDShow();
+}
+
+void report_telemetry(void)
+{
+	telemetry t;
+	uint32_t now = clock_now();
 	
-	// Should be redundant
-	(*nL)->next = NULL;
+	// A frame now would land in the middle of the dump, skip this one
+	if(trace_sending()) return;
 	
-	return;
+	t.time = now / CLOCK_MS(1);
+	t.alum = alum;
+	t.steel = steel;
+	t.white = white;
+	t.black = black;
+	t.queued = size(&item_queue);
+	t.duty = belt_moving() ? belt_speed() : 0;
+	t.duty_mean = belt_average();
+	t.flags = 0;
+	if(!running) t.flags |= TELEMETRY_PAUSED;
+	if(ramp_down) t.flags |= TELEMETRY_RAMP_DOWN;
+	if(complete) t.flags |= TELEMETRY_COMPLETE;
+	
+	// Over the run, from the first item's arrival to the last landing
+	uint32_t run_ms = landed ? (last_landed - first_seen) / CLOCK_MS(1) : 0;
+	t.ipm = run_ms >= 100 ? landed * 6000UL / (run_ms / 100) : 0;
+	t.latency_mean = landed ? latency_total_ms / landed : 0;
+	t.latency_max = latency_max_ms;
+	
+	t.move_planned = moves ? moves_expected_ms / moves : 0;
+	t.move_actual = moves ? moves_actual_ms / moves : 0;
+	t.move_last = move_actual_ms;
+	t.stray_edges = spurious_edges + lost_edges;
+	
+	telemetry_send(&t);
 }
 
-void dequeue(link **h, link **t, link **deQueuedLink)
+// Changes wait while an item is being measured, is at the exit sensor or
+// is falling, so no item is handled under two settings
+void tune_params(void)
 {
-	*deQueuedLink = *h;
+	// Answers wait for the dump, as do the changes they report
+	if(trace_sending()) return;
+	param_poll();
+	if(param_pending() && !at_exit && !dropping && !measure_busy()) param_apply();
+}
 
-	if(*deQueuedLink != NULL)
-	{
-		// Queue not empty
-		*h = (*h)->next;
+void use_margin(void)
+{
+	measure_margin(no_item_margin);
+}
 
-		if(*t == *deQueuedLink)
-		{
-			// Special case for size 1 queue
-			*t = *h;
-		}
-		else
-		{
-			(*deQueuedLink)->next = NULL;
-		}
+// The governor slows the belt from belt_max toward belt_cruise as the
+// queue fills and no further than belt_min, so they must stay in order
+char belt_order(const param *p, uint16_t value)
+{
+	uint16_t low = (p->value == &belt_min) ? value : param_next(&belt_min);
+	uint16_t mid = (p->value == &belt_cruise) ? value : param_next(&belt_cruise);
+	uint16_t high = (p->value == &belt_max) ? value : param_next(&belt_max);
 	
-	}
-	else
+	return low < mid && mid <= high;
+}
+
+void send_trace(void)
+{
+	if(trace_faulted()) trace_dump();
+	if(trace_send()) sched_signal(TASK_TRACE);
+}
+
+// Longest run of up to four main loop tasks from 'first', us
+void print_wcet(uint8_t first){
+	LCDClear();
+	for(uint8_t i = 0; i < 4 && first + i < sched_tasks(); i++)
 	{
-		// Empty list
-		*h = NULL;
-		*t = NULL;
+		uint8_t x = (i & 1) ? 8 : 0;
+		uint8_t y = i >> 1;
+		LCDWriteStringXY(x,y,sched_name(first + i));
+		uint16_t us = sched_wcet_us(first + i);
+		LCDWriteIntXY(x + 3,y,us > 9999 ? 9999 : us,4);
 	}
+}
 
-	return;
+// Exits handled without and with stopping the belt
+void print_stops(){
+	LCDClear();
+	LCDWriteStringXY(0,0, "Stops avoided:");
+	LCDWriteIntXY(14,0,stops_avoided,2);
+	LCDWriteStringXY(0,1, "Stops forced:");
+	LCDWriteIntXY(14,1,stops_forced,2);
 }
 
-char firstValue(link **h)
+// Belt duty cycle, highest and averaged over the run
+void print_belt(){
+	LCDClear();
+	LCDWriteStringXY(0,0, "Belt peak %:");
+	LCDWriteIntXY(14,0,belt_peak(),2);
+	LCDWriteStringXY(0,1, "Belt mean %:");
+	LCDWriteIntXY(14,1,belt_average(),2);
+}
+
+// Worst interrupt latency seen
+void print_latency(){
+	LCDClear();
+	LCDWriteStringXY(0,0, "Step lat us:");
+	LCDWriteIntXY(12,0,step_latency_max,4);
+	LCDWriteStringXY(0,1, "Tick lat us:");
+	LCDWriteIntXY(12,1,tick_latency_max,4);
+}
+
+// Longest an exit edge waited for the dish task, and the last item's time
+// from optic to exit sensor, both from the ISR stamps
+void print_edges(){
+	uint32_t lag_us = exit_lag_max * (1000000UL / CLOCK_HZ);
+	
+	LCDClear();
+	LCDWriteStringXY(0,0, "Exit lag us:");
+	LCDWriteIntXY(12,0,lag_us > 9999 ? 9999 : lag_us,4);
+	LCDWriteStringXY(0,1, "Transit ms:");
+	LCDWriteIntXY(12,1,exit_transit / CLOCK_MS(1),4);
+}
+
+// Exit edges that matched no item, and items that left without an edge
+// of their own
+void print_exits(){
+	LCDClear();
+	LCDWriteStringXY(0,0, "Stray edges:");
+	LCDWriteIntXY(13,0,spurious_edges + lost_edges,3);
+	LCDWriteStringXY(0,1, "Unseen exits:");
+	LCDWriteIntXY(13,1,unseen_exits,3);
+}
+
+// Average dish turn time, planned and measured
+void print_moves(){
+	LCDClear();
+	LCDWriteStringXY(0,0, "Planned ms:");
+	LCDWriteIntXY(12,0,moves ? moves_expected_ms / moves : 0,4);
+	LCDWriteStringXY(0,1, "Actual ms:");
+	LCDWriteIntXY(12,1,moves ? moves_actual_ms / moves : 0,4);
+}
+
+// Moves started early and the time that saved
+void print_blends(){
+	LCDClear();
+	LCDWriteStringXY(0,0, "Blends:");
+	LCDWriteIntXY(8,0,blends_extended,3);
+	LCDWriteStringXY(11,0, "/");
+	LCDWriteIntXY(12,0,blends,3);
+	
+	// LCDWriteInt() takes an int and at most five digits
+	uint32_t saved_s = blend_saved_ms / 1000;
+	LCDWriteStringXY(0,1, "Saved s:");
+	LCDWriteIntXY(12,1,saved_s > 9999 ? 9999 : saved_s,4);
+}
+
+// Stop the belt, let the move under way end and seek the homing sensor.
+// INT2 brakes the seek and resets the dish to black.
+void rehome(void)
 {
-	if(*h != NULL){
-		return((*h)->itemType);
+	if(!rehoming)
+	{
+		trace_fault(FAULT_DISH_LOST);
+		rehoming = 1;
+		rehomes++;
+		homed_flag = 0;
+		belt_stop();
 	}
-	else
+	if(motion_busy()) return;
+	
+	if(!homed_flag)
 	{
-		return 'E';
+		// A turn and a quarter finds it, or the next one tries again
+		disk_direction = CW;
+		motion_start(CW, MOTION_REV + QUARTER_TURN, &dish_profile);
+		return;
 	}
+	
+	// The trace task dumps the fault once the ring has frozen
+	rehoming = 0;
+	settle_until = clock_now();
+	if(!held_at_exit) belt_run();
 }
 
-void clearQueue(link **h, link **t)
+#ifdef TUNING_MODE
+profile_params tune_scale(const profile_params *base, char what, uint16_t percent)
 {
-	link *temp;
-
-	// Deallocate all items
-	while (*h != NULL){
-		temp = *h;
-		*h=(*h)->next;
-		free(temp);
-	}
+	profile_params p = *base;
 	
-	// Update tail
-	*t = NULL;		
-
-	return;
+	if(what == TUNE_ACCEL)
+	{
+		// Jerk in step, so the time to reach full acceleration is unchanged
+		p.accel = (uint32_t)base->accel * percent / 100;
+		p.jerk = base->jerk / 100 * percent;
+	}
+	else
+	{
+		p.cruise = (uint32_t)base->cruise * percent / 100;
+		if(p.cruise < p.start) p.cruise = p.start;
+	}
+	return p;
 }
 
-char isEmpty(link **h)
+// Quarter and half turns each way under test, then a slow turn past black
+// so the homing sensor checks where the dish really is. A dish that slipped
+// is found again before the next trial.
+char tune_trial(const profile_params *params)
 {
-	return(*h == NULL);
+	static const uint8_t turns[] = { QUARTER_TURN, QUARTER_TURN, QUARTER_TURN, QUARTER_TURN, HALF_TURN, HALF_TURN };
+	unsigned int slipped = slips;
+	char ok;
+	
+	profile_build(&dish_profile, params, mode_wanted);
+	for(uint8_t direction = CW; direction <= CCW; direction++)
+	{
+		for(uint8_t i = 0; i < sizeof(turns); i++)
+		{
+			motion_start(direction, turns[i], &dish_profile);
+			while(motion_busy()) hal_idle();
+			mTimer(TUNE_REST);
+		}
+	}
+	
+	profile_build(&dish_profile, &profile_presets[PROFILE_SLOW], mode_wanted);
+	motion_start(CW, MOTION_REV + QUARTER_TURN, &dish_profile);
+	while(motion_busy()) hal_idle();
+	ok = slips == slipped && !motion_lost();
+	
+	homed_flag = ok;
+	while(!homed_flag)
+	{
+		motion_start(CW, MOTION_REV + QUARTER_TURN, &dish_profile);
+		while(motion_busy()) hal_idle();
+	}
+	mTimer(TUNE_REST);
+	
+	// Leave the profile in use to be rebuilt before sorting
+	profile_used = PROFILES;
+	return ok;
 }
 
-int size(link **h, link **t)
+// Largest % of 'base' that passes a trial: up by a quarter at a time until
+// one fails, then halve the gap to within 5%
+uint16_t tune_search(const profile_params *base, char what)
 {
-	link *temp;
-	int size = 0;
-	temp = *h;
-
-	while(temp != NULL)
+	uint16_t good = 0;
+	uint16_t bad = 0;
+	uint16_t percent = 100;
+	
+	while(!bad && good < TUNE_LIMIT)
 	{
-		// Iterate until null terminator found
-		size++;
-		temp = temp->next;
+		profile_params p = tune_scale(base, what, percent);
+		LCDWriteStringXY(0,1,"Trying %:");
+		LCDWriteIntXY(10,1,percent,3);
+		if(tune_trial(&p)) good = percent;
+		else bad = percent;
+		percent = percent * 5 / 4;
+		if(percent > TUNE_LIMIT) percent = TUNE_LIMIT;
 	}
+	
+	// The preset itself failed; search down from it
+	if(!good) good = 50;
+	
+	while(bad && bad - good > good / 20)
+	{
+		percent = (good + bad) / 2;
+		profile_params p = tune_scale(base, what, percent);
+		LCDWriteStringXY(0,1,"Trying %:");
+		LCDWriteIntXY(10,1,percent,3);
+		if(tune_trial(&p)) good = percent;
+		else bad = percent;
+	}
+	return good;
+}
+#endif
 
-	return(size);
+// Step loss found and corrected at the homing sensor
+void print_slips(){
+	LCDClear();
+	LCDWriteStringXY(0,0, "Slips:");
+	LCDWriteIntXY(6,0,slips,4);
+	LCDWriteStringXY(11,0, "Rh:");
+	LCDWriteIntXY(14,0,rehomes,2);
+	LCDWriteStringXY(0,1, "Steps fixed:");
+	LCDWriteIntXY(12,1,slipped_steps,4);
+}
+
+// Startup homing time
+void print_homing(){
+	LCDClear();
+	LCDWriteStringXY(0,0, "Homing ms:");
+	LCDWriteIntXY(11,0,homing_ms,5);
+	LCDWriteStringXY(0,1, "Approach ms:");
+	LCDWriteIntXY(12,1,approach_ms,4);
 }
 
 // Killswitch ISR
 ISR(INT0_vect)
 {
 	// Stop motor and wait for reset
-	PORTL |= 0xF0;
+	hal_belt_brake();
 	LCDClear();
 	LCDWriteStringXY(0,0,"Kill Switch Hit");
-	while(1);
+	LCDFlush();
+	hal_halt();
 }
 
 // Pause/resume conveyor belt ISR
 ISR(INT1_vect)
 {
-	if( running )
-	{
-		// Pause
-		PORTL |= 0xF0;
-		running = 0;
-	}
-	else
-	{
-		// Resume
-		PORTL &= 0x7F;
-		running = 1;
-	}
-	
-	// Debounce
-	mTimer(20);
-	EIFR |= _BV(INTF1);
+	event_post(EVENT_PAUSE);
+	debounce(HAL_INT_PAUSE);
+	sched_signal(TASK_BUTTONS);
 }
 
 // Stepper homing interrupt
 ISR(INT2_vect)
 {
-	disk_location = 'b';
-	homed_flag = 1;
-	EIMSK &= ~_BV(INT2);
+	// First edge sets the reference, the rest check the dish against it
+	if(!homed_flag)
+	{
+		motion_home();
+		disk_location = 'b';
+		homed_flag = 1;
+		return;
+	}
+	
+	int16_t slip = motion_home_check();
+	if(slip)
+	{
+		slips++;
+		slipped_steps += (slip < 0) ? -slip : slip;
+	}
 }
 
 // Ramp down interrupt
 ISR(INT3_vect)
 {
-	if(!ramp_down)
-	{
-		LCDWriteStringXY(0,0,"Ramping down...");
-		ramp_down = 1;
-
-		// Start timer and enable its interrupt
-		TCNT5 = 0x0000;
-		TIFR5 |= _BV(OCF5A);
-		TIMSK5 |= _BV(OCIE5A);
-	}
-	
-	// Debounce
-	mTimer(20);
-	EIFR |= _BV(INTF3);
+	// Ramp down only happens once, so the button stays masked
+	event_post(EVENT_RAMP);
+	hal_extint_disable(HAL_INT_RAMP);
+	sched_signal(TASK_BUTTONS);
 }
 
 // End of conveyor belt interrupt
 ISR(INT4_vect)
 {	
-	exiting = 1;
+	// Stamp every edge, the dish task tells items from bounces
+	uint8_t in = exit_edges_in;
+	if((uint8_t)(in - exit_edges_out) >= EXIT_EDGES)
+	{
+		lost_edges++;
+		trace_fault(FAULT_EXIT_LOST);
+		return;
+	}
+	exit_edges[in & (EXIT_EDGES - 1)].time = clock_now();
+	exit_edges[in & (EXIT_EDGES - 1)].travel = belt_odometer();
+	exit_edges_in = in + 1;
+	trace(TRACE_EXIT, TRACE_NONE, 0);
+	sched_signal(TASK_DISH);
 }
 
 // First sensor trigger
 ISR(INT5_vect)
 {
+	#ifdef TIMER_CALIBRATION_MODE
 	inbound = 1;
+	#else
+	measure_start();
+	trace(TRACE_OPTIC, TRACE_NONE, 0);
+	#endif
 }
 
-// Exit timer interrupt
-ISR(TIMER4_COMPA_vect)
+// Stepper step interrupt
+ISR(TIMER1_COMPA_vect)
 {
-	// Mask this interrupt
-	TIMSK4 &= ~_BV(OCIE4A);
-	
-	#ifndef EXIT_CALIBRATION_MODE
+	// The counter restarts at the compare match, so it reads how long
+	// this ISR was held off
+	uint16_t latency = hal_timer_count(HAL_TIMER_STEPPER);
+	if(latency > step_latency_max) step_latency_max = latency;
 	
-	// Enable exit sensor interrupt
-	EIMSK |= _BV(INT4);
-	
-	#else
-	
-	// Not a double-count if this timer maxes out
-	is_double_count = 0;
+	motion_tick();
+}
+
+// Belt PWM period, paces the display and the button debounce
+ISR(TIMER0_OVF_vect)
+{
+	uint16_t latency = hal_timer_count(HAL_TIMER_PWM);
+	if(latency > tick_latency_max) tick_latency_max = latency;
 	
-	#endif
+	LCDRefresh();
+	events_tick();
 }
 
-// Ramp-down timer
-ISR(TIMER5_COMPA_vect)
+// Byte received, wake the command task on a line end
+ISR(USART0_RX_vect)
 {
-	TIMSK5 &= ~_BV(OCIE5A);
-	finishing = 1;
+	if(uart_received(hal_uart_recv())) sched_signal(TASK_PARAMS);
+}
+
+// Transmit data register empty
+ISR(USART0_UDRE_vect)
+{
+	uart_tx_ready();
+}
+
+// System clock overflow
+ISR(TIMER5_OVF_vect)
+{
+	clock_overflow();
 }
 
 // ISR for ADC Conversion Completion
 ISR(ADC_vect)
 {
 	// Get ADC result and indicate successful conversion
-	ADC_result = 0;
-	ADC_result |= ADCL;
-	ADC_result |= (ADCH & 0x03) << 8;
+	ADC_result = hal_adc_read();
 	ADC_result_flag = 1;
+	
+	// Fold it into the measurement of the item at the sensor and have the
+	// main loop classify it once the record is finished
+	if(measure_sample(ADC_result)) sched_signal(TASK_CLASSIFY);
 }
 
 ISR(BADISR_vect)
@@ -1007,6 +1696,6 @@ ISR(BADISR_vect)
 	LCDClear();
 	LCDWriteStringXY(1,0, "Something went");
 	LCDWriteStringXY(6,1, "wrong!");
-	while(1);
+	LCDFlush();
+	hal_halt();
 }
-
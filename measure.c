@@ -0,0 +1,320 @@
+#include "hal.h"
+#include "clock.h"
+#include "belt.h"
+#include "measure.h"
+
+// ADC counts of noise the edge detection ignores
+#define MEASURE_NOISE		2
+
+// Reduction of one dip below the threshold
+typedef struct dip{
+	uint16_t min;
+	uint16_t dwell;
+	uint16_t fall;
+	uint16_t knee;		// Depth below the threshold at the end of the edge so far
+	uint32_t area;
+	uint32_t from;		// Belt travel when the reflectance went below the threshold
+	uint32_t to;		// ... and when it last came back above it
+	uint8_t below;		// Under it now; belt travel is read on crossings only
+} dip;
+
+// Reduction for the item currently in front of the sensor
+static volatile uint8_t active = 0;
+static volatile uint8_t pending = 0;	// Another item arrived before the window closed
+static uint8_t edge;			// The record started on an optic edge, not a split
+static dip cur;
+static uint16_t cur_count;
+static uint32_t cur_sum;
+static uint32_t cur_start;
+static uint32_t cur_travel;
+static uint32_t pending_start;
+static uint32_t pending_travel;
+
+// Once the item's dip is nearly over, the highest reflectance since is
+// its crest, and anything after that is kept apart as well. If the
+// reflectance falls well back from the crest and goes deep before it
+// settles at the baseline, that is a touching item. Between two items
+// that touch, the crest can be too brief to clear the threshold.
+static uint8_t risen;
+static uint16_t crest;
+static dip next;
+volatile uint16_t measure_splits = 0;
+
+static uint16_t threshold;
+static uint16_t margin;
+
+// Reflectance with nothing at the sensor, x2^MEASURE_TRACK, followed
+// between items. Held while an item is measured.
+static uint32_t baseline = 0;
+static uint16_t level;			// The same in ADC counts
+static uint8_t settled;			// Samples in a row back at it
+static uint16_t late;			// Samples since the item left the optic sensor
+volatile uint8_t measure_timeouts = 0;
+
+// Finished records. ISR(ADC_vect) produces, the main loop consumes.
+static measurement done[MEASURE_SLOTS];
+static volatile uint8_t done_head = 0;
+static volatile uint8_t done_tail = 0;
+volatile uint8_t measure_overruns = 0;
+
+void measure_init(uint16_t counts)
+{
+	margin = counts;
+	baseline = 0;
+	hal_adc_free_run();
+}
+
+static void clear(dip *d)
+{
+	d->min = 0xFFFF;
+	d->dwell = 0;
+	d->fall = 0;
+	d->knee = 0;
+	d->area = 0;
+	d->from = d->to = 0;
+	d->below = 0;
+}
+
+static uint8_t deep(const dip *d)
+{
+	return threshold > MEASURE_DIP && d->min < threshold - MEASURE_DIP;
+}
+
+static void fold(dip *d, uint16_t value)
+{
+	if(value < d->min) d->min = value;
+
+	// Samples taken with the belt stopped would weight the shape toward
+	// wherever the item stood
+	if(!belt_moving()) return;
+
+	if(value < threshold)
+	{
+		if(!d->below)
+		{
+			d->below = 1;
+			if(!d->dwell) d->from = belt_odometer();
+		}
+		// The leading edge is over once the dip stops deepening by more than
+		// an eighth at a time; noise along the bottom does not do that
+		uint16_t depth = threshold - value;
+		if(depth > d->knee + d->knee / 8 + MEASURE_NOISE)
+		{
+			d->knee = depth;
+			d->fall = d->dwell;
+		}
+		if(d->dwell < 0xFFFF) d->dwell++;
+		d->area += depth;
+	}
+	else if(d->below)
+	{
+		d->below = 0;
+		d->to = belt_odometer();
+	}
+}
+
+static void begin(uint32_t start, uint32_t travel)
+{
+	cur_start = start;
+	cur_travel = travel;
+	cur_count = 0;
+	cur_sum = 0;
+	clear(&cur);
+	risen = 0;
+	settled = 0;
+	late = 0;
+	edge = 1;
+	active = 1;
+}
+
+void measure_start(void)
+{
+	// Stamped here, not when the main loop gets round to the item
+	uint32_t now = clock_now();
+	uint32_t travel = belt_odometer();
+
+	if(active && !edge)
+	{
+		// The edge of a touching item already split off
+		cur_start = now;
+		cur_travel = travel;
+		edge = 1;
+	}
+	else if(active)
+	{
+		pending = 1;
+		pending_start = now;
+		pending_travel = travel;
+	}
+	else
+	{
+		begin(now, travel);
+	}
+}
+
+// Hand the record over to the main loop
+static char finish(void)
+{
+	uint8_t tail = done_tail;
+
+	if((uint8_t)(tail - done_head) >= MEASURE_SLOTS)
+	{
+		measure_overruns++;
+		return 0;
+	}
+
+	measurement *m = &done[tail & (MEASURE_SLOTS - 1)];
+	m->min = cur.min;
+	m->count = cur_count;
+	m->sum = cur_sum;
+	m->baseline = level;
+	m->threshold = threshold;
+	m->dwell = cur.dwell;
+	m->fall = cur.fall;
+	m->area = cur.area;
+	if(cur.below) cur.to = belt_odometer();
+	m->length = cur.dwell ? cur.to - cur.from : 0;
+	m->start = cur_start;
+	m->travel = cur_travel;
+	m->window = clock_now() - cur_start;
+	hal_barrier();
+	done_tail = tail + 1;
+	return 1;
+}
+
+char measure_sample(uint16_t value)
+{
+	char finished = 0;
+
+	// First sample, or between items
+	if(!baseline) baseline = (uint32_t)value << MEASURE_TRACK;
+	if(!active && threshold > MEASURE_DIP && value < threshold - MEASURE_DIP)
+	{
+		// An item with no optic edge, touching one that stood at the
+		// sensor until its window closed
+		begin(clock_now(), belt_odometer());
+		edge = 0;
+		measure_splits++;
+	}
+	else if(!active)
+	{
+		baseline += value - (baseline >> MEASURE_TRACK);
+		level = baseline >> MEASURE_TRACK;
+		threshold = (level > margin) ? level - margin : 0;
+		return 0;
+	}
+
+	if(cur_count < 0xFFFF) cur_count++;
+	cur_sum += value;
+
+	fold(&cur, value);
+	if(!risen)
+	{
+		// A pale item may never go deep, but it stays under for long
+		uint8_t whole = deep(&cur) || cur.dwell >= MEASURE_SPAN;
+		if(whole && value + (threshold - cur.min) / MEASURE_RISE >= threshold)
+		{
+			risen = 1;
+			crest = value;
+			clear(&next);
+		}
+	}
+	else
+	{
+		if(value > crest)
+		{
+			crest = value;
+			clear(&next);
+		}
+		fold(&next, value);
+		if(value + MEASURE_DIP < crest && deep(&next))
+		{
+			// Touching item: this one ends where the next began, which
+			// takes over the optic edge if it has already been seen
+			finished = finish();
+			measure_splits++;
+			if(pending) begin(pending_start, pending_travel);
+			else begin(clock_now(), belt_odometer());
+			edge = pending;
+			pending = 0;
+			cur = next;
+			cur_count = next.dwell;
+			return finished;
+		}
+	}
+
+	if(value + margin / 2 >= level)
+	{
+		if(settled < MEASURE_CLEAR) settled++;
+	}
+	else
+	{
+		settled = 0;
+	}
+	if(hal_optic_active() || !belt_moving()) late = 0;
+	else if(late < MEASURE_LATE) late++;
+
+	// Close the window once the dip is over, or once an item that never
+	// made one has left the optic sensor. Noise along the shallow edges of
+	// a dark item must not pass for a whole dip.
+	if(settled >= MEASURE_CLEAR && (deep(&cur) || !hal_optic_active()))
+	{
+		finished = finish();
+		active = 0;
+	}
+	else if(late >= MEASURE_LATE)
+	{
+		// Ambient light that shifted during the window keeps it from ever
+		// settling at the level held for it. Close it anyway and follow
+		// the light from here. A record with no optic edge of its own was
+		// most likely the shift itself, not an item.
+		if(edge) finished = finish();
+		active = 0;
+		measure_timeouts++;
+		baseline = (uint32_t)value << MEASURE_TRACK;
+		level = value;
+		threshold = (level > margin) ? level - margin : 0;
+	}
+	if(!active && pending)
+	{
+		pending = 0;
+		begin(pending_start, pending_travel);
+	}
+	return finished;
+}
+
+char measure_collect(measurement *m)
+{
+	uint8_t head = done_head;
+
+	if(head == done_tail) return 0;
+	*m = done[head & (MEASURE_SLOTS - 1)];
+	hal_barrier();
+	done_head = head + 1;
+
+	// The ISR kept odometer readings, which take a divide to turn into travel
+	m->travel = belt_travel_at(m->travel);
+	m->length = belt_span(m->length);
+	return 1;
+}
+
+void measure_margin(uint16_t counts)
+{
+	uint8_t state = hal_irq_save();
+	margin = counts;
+	hal_irq_restore(state);
+}
+
+char measure_busy(void)
+{
+	return active || pending;
+}
+
+uint16_t measure_baseline(void)
+{
+	uint8_t state = hal_irq_save();
+	uint16_t b = level;
+	hal_irq_restore(state);
+
+	return b;
+}
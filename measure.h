@@ -0,0 +1,66 @@
+/*
+ * measure.h
+ *
+ * Reflectance measurement of items passing the optic sensor. The ADC runs
+ * free and ISR(ADC_vect) folds every sample into a running reduction for
+ * the item in front of the sensor. The main loop only collects finished
+ * records, so it never waits on a conversion.
+ *
+ * Besides the minimum, the reduction keeps the shape of the dip: how far
+ * and for how long the item held the reflectance under the no-item
+ * threshold, and how soon it reached its minimum, for classify().
+ *
+ * The no-item baseline is filtered from every sample taken between items,
+ * so it follows ambient light through the day, and the threshold sits a
+ * fixed margin under it. The window is not a fixed time. It closes once
+ * the reflectance has bottomed out clearly below the threshold and come
+ * back to the baseline for a few samples in a row, or, if the light has
+ * shifted so that it never does, once the item is well past the sensor.
+ *
+ * Items that touch keep the optic sensor covered across both. A second
+ * deep dip after the first has nearly come back up splits the record in
+ * two, so each is classified and queued on its own.
+ */
+
+
+#ifndef MEASURE_H_
+#define MEASURE_H_
+
+#include <stdint.h>
+
+#define MEASURE_SLOTS	4	// Finished records waiting for the main loop, power of two
+#define MEASURE_TRACK	8	// Baseline filter time constant, 2^n samples between items
+#define MEASURE_CLEAR	16	// Samples in a row back within half the margin of the baseline that close the window
+#define MEASURE_DIP	12	// ADC counts under the threshold a dip must reach to be over when it comes back
+#define MEASURE_RISE	4	// A dip is nearly over once back within 1/n of its depth of the threshold
+#define MEASURE_SPAN	256	// ... or, if shallow, once it has lasted this many samples
+#define MEASURE_LATE	2048	// Samples with the belt moving and the optic sensor clear that close a window regardless, about 0.2s
+
+typedef struct measurement{
+	uint16_t min;		// Lowest reflectance seen
+	uint16_t count;		// Samples taken
+	uint32_t sum;		// Sum of all samples
+	uint16_t baseline;	// Reflectance with no item, when this one arrived
+	uint16_t threshold;	// ... and below which the item counted as present
+	uint16_t dwell;		// Samples below the threshold
+	uint16_t fall;		// ... on the leading edge, until it stopped deepening
+	uint32_t area;		// Sum of how far those samples were below it
+	uint32_t length;	// Belt travel while below it, clock ticks at the reference duty
+	uint32_t start;		// Clock when the item reached the optic sensor
+	uint32_t travel;	// ... and belt travel then, both taken in the edge's ISR
+	uint32_t window;	// Clock ticks from then until the window closed
+} measurement;
+
+void	measure_init	(uint16_t margin);			// ADC counts under the baseline at which an item is present, about twice the sensor's noise
+void	measure_margin	(uint16_t counts);		// Takes effect at the next sample between items
+uint16_t measure_baseline(void);				// No-item reflectance now
+char	measure_busy	(void);				// An item is being measured
+void	measure_start	(void);				// Optic sensor rising edge, ISR context
+char	measure_sample	(uint16_t value);		// ADC conversion complete, ISR context; 1 if a record was finished
+char	measure_collect	(measurement *m);		// Returns 0 if nothing is ready
+
+extern volatile uint8_t measure_overruns;		// Records lost because nobody collected them
+extern volatile uint16_t measure_splits;		// Items measured without their own optic edge
+extern volatile uint8_t measure_timeouts;		// Windows closed by MEASURE_LATE rather than the baseline
+
+#endif /* MEASURE_H_ */
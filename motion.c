@@ -0,0 +1,378 @@
+#include "hal.h"
+#include "clock.h"
+#include "motion.h"
+
+// Half-step coil patterns for PORTA, in clockwise order. PA0 and PA3
+// enable coils A and B, PA1/PA2 and PA4/PA5 set their polarity. Full steps
+// use the odd entries, with both coils on.
+static const uint8_t stepper[8] = {
+	0b00000011, 0b00011011, 0b00011000, 0b00011101,
+	0b00000101, 0b00101101, 0b00101000, 0b00101011
+};
+
+// Index of the pattern currently driving the coils
+static volatile uint8_t position = 1;
+
+// Motor steps per full step
+static uint8_t microsteps = MOTION_FULL;
+
+// Left half stepping on a single coil position; the next step is a half
+// step onto a full step position
+static uint8_t align = 0;
+
+// Commanded dish angle, motor steps clockwise from the homing sensor, and
+// a slip correction still owed to the next move, motor steps clockwise
+static int16_t angle = 0;
+static int16_t owed = 0;
+
+// Motor steps since the commanded angle passed home without the sensor
+// firing, -1 if it has fired, and since the sensor last fired
+static int16_t unseen = -1;
+static uint16_t since_seen = 0xFFFF;
+static volatile uint8_t lost = 0;
+
+// Move in progress
+static volatile uint8_t busy = 0;
+static volatile uint8_t held = 0;
+static uint8_t move_direction;
+static uint16_t remaining;		// Steps still to issue
+static const profile *ramp;
+static uint8_t level;			// Ramp entry in use
+static uint16_t interval;		// Interval after the step just issued
+static uint32_t left_us;		// Intervals not yet elapsed
+static uint32_t started;		// Clock at the first step
+static uint32_t last_us = 0;
+
+void motion_init(void)
+{
+	busy = 0;
+	held = 0;
+	hal_timer_irq_disable(HAL_TIMER_STEPPER);
+}
+
+// The ramp is climbed one entry per step and descended so that it is back
+// at the start rate with the last step. Following it from step to step,
+// rather than from the step number, lets a move be extended smoothly.
+static uint8_t next_level(const profile *p, uint8_t lv, uint16_t left)
+{
+	lv++;
+	if(lv > left) lv = left;
+	if(lv > p->length - 1) lv = p->length - 1;
+	return lv;
+}
+
+// Intervals after each of the next n steps, from 'left' steps still to
+// issue with the ramp at entry 'lv'
+static uint32_t ahead_us(const profile *p, uint16_t left, uint8_t lv, uint16_t n)
+{
+	uint32_t us = 0;
+
+	while(n--)
+	{
+		left--;
+		lv = next_level(p, lv, left);
+		us += p->ramp[lv];
+	}
+	return us;
+}
+
+// Advance one phase and energise it
+static void step(uint8_t direction)
+{
+	uint8_t stride = 2 / microsteps;
+	uint8_t turn = 1;
+
+	int16_t rev = MOTION_REV * microsteps;
+
+	// The angle was rounded down on leaving half stepping, so the half
+	// step clockwise counts as a whole one and counterclockwise as none
+	if(align)
+	{
+		stride = 1;
+		turn = (direction == CW);
+		align = 0;
+	}
+
+	if(direction == CW)
+	{
+		position = (position + stride) & 0x07;
+		if(turn && ++angle >= rev) angle = 0;
+	}
+	else
+	{
+		position = (position - stride) & 0x07;
+		if(turn && --angle < 0) angle = rev - 1;
+	}
+
+	// The sensor should fire within the slip the check below corrects of
+	// the dish passing home. If it has not after a quarter turn, the
+	// rotor is too far out to be trusted.
+	if(since_seen < 0xFFFF) since_seen++;
+	if(angle == 0 && since_seen > 2 * microsteps) unseen = 0;
+	else if(unseen >= 0 && ++unseen > MOTION_REV / 4 * microsteps)
+	{
+		unseen = -1;
+		lost = 1;
+	}
+
+	hal_stepper_write(stepper[position]);
+}
+
+void motion_mode(uint8_t mode)
+{
+	if(busy) return;
+
+	// A half step position is a single coil one. Rather than stepping off
+	// it now, with no time for the rotor to follow before the next move,
+	// the next move starts with a half step at its first interval.
+	uint8_t state = hal_irq_save();
+	align = (mode == MOTION_FULL && microsteps != MOTION_FULL && !(position & 1));
+	angle = (int32_t)angle * mode / microsteps;
+	owed = owed * mode / microsteps;
+	microsteps = mode;
+	hal_irq_restore(state);
+}
+
+uint8_t motion_microsteps(void)
+{
+	return microsteps;
+}
+
+// Start a move of 'steps' motor steps
+static void go(uint8_t direction, uint16_t steps, const profile *p)
+{
+	// A half step counterclockwise to align leaves the angle where it was
+	if(align && direction == CCW) steps++;
+
+	move_direction = direction;
+	remaining = steps - 1;
+	ramp = p;
+	level = 0;
+	interval = p->ramp[0];
+	left_us = interval + ahead_us(p, remaining, 0, remaining);
+	started = clock_now();
+	busy = 1;
+
+	// First step now, the rest from the compare ISR
+	step(direction);
+	hal_timer_set_top(HAL_TIMER_STEPPER, interval);
+	hal_timer_restart(HAL_TIMER_STEPPER);
+	hal_timer_irq_enable(HAL_TIMER_STEPPER);
+}
+
+char motion_start(uint8_t direction, uint16_t steps, const profile *p)
+{
+	if(busy || steps == 0) return 0;
+	steps *= microsteps;
+
+	// Make up for slip found since the last move
+	uint8_t state = hal_irq_save();
+	int16_t fix = (direction == CW) ? owed : -owed;
+	if((int16_t)steps + fix > 0)
+	{
+		steps += fix;
+		owed = 0;
+	}
+	hal_irq_restore(state);
+
+	go(direction, steps, p);
+	return 1;
+}
+
+char motion_correct(const profile *p)
+{
+	if(busy) return 0;
+
+	uint8_t state = hal_irq_save();
+	int16_t fix = owed;
+	owed = 0;
+	hal_irq_restore(state);
+
+	if(fix > 0) go(CW, fix, p);
+	else if(fix < 0) go(CCW, -fix, p);
+	return fix != 0;
+}
+
+int16_t motion_owed(void)
+{
+	uint8_t state = hal_irq_save();
+	int16_t o = owed;
+	hal_irq_restore(state);
+
+	return o;
+}
+
+void motion_step(uint8_t direction)
+{
+	if(!busy) step(direction);
+}
+
+uint8_t motion_busy(void)
+{
+	return busy;
+}
+
+uint32_t motion_remaining(void)
+{
+	uint8_t state = hal_irq_save();
+	uint32_t us = busy ? left_us : 0;
+	hal_irq_restore(state);
+
+	return us;
+}
+
+char motion_extend(uint8_t direction, uint16_t steps)
+{
+	uint8_t state = hal_irq_save();
+	uint16_t left = remaining;
+	uint8_t lv = level;
+
+	if(!busy || held || direction != move_direction)
+	{
+		hal_irq_restore(state);
+		return 0;
+	}
+	steps *= microsteps;
+	remaining += steps;
+	hal_irq_restore(state);
+
+	// The ISR keeps stepping meanwhile and takes its intervals off left_us,
+	// so only the difference the extension makes is added
+	uint32_t more = ahead_us(ramp, left + steps, lv, left + steps) - ahead_us(ramp, left, lv, left);
+	state = hal_irq_save();
+	left_us += more;
+	hal_irq_restore(state);
+	return 1;
+}
+
+uint32_t motion_reach_us(const profile *p, uint16_t extra, uint16_t ahead)
+{
+	uint8_t state = hal_irq_save();
+	uint8_t moving = busy;
+	uint16_t left = remaining;
+	uint8_t lv = level;
+	uint16_t next = interval;
+	uint16_t elapsed = hal_timer_count(HAL_TIMER_STEPPER);
+	hal_irq_restore(state);
+
+	extra *= microsteps;
+	ahead *= microsteps;
+
+	if(!moving)
+	{
+		// The first step is immediate, step n follows n - 1 intervals later
+		if(ahead == 0) return 0;
+		return p->ramp[0] + ahead_us(p, extra - 1, 0, ahead - 1);
+	}
+
+	// Step left + ahead + 1 from now takes the dish past the slack
+	if(elapsed > next) elapsed = next;
+	return next - elapsed + ahead_us(ramp, left + extra, lv, left + ahead);
+}
+
+uint32_t motion_last_us(void)
+{
+	uint8_t state = hal_irq_save();
+	uint32_t us = last_us;
+	hal_irq_restore(state);
+
+	return us;
+}
+
+void motion_hold(uint8_t hold)
+{
+	if(hold || !held || !busy)
+	{
+		held = hold;
+		return;
+	}
+
+	// The rotor has stopped, so pick the move up again from the start rate
+	uint8_t state = hal_irq_save();
+	uint16_t left = remaining;
+	uint8_t lv = level;
+	uint16_t was = interval;
+	level = 0;
+	interval = ramp->ramp[0];
+	hal_timer_set_top(HAL_TIMER_STEPPER, interval);
+	held = 0;
+	hal_irq_restore(state);
+
+	uint32_t more = interval + ahead_us(ramp, left, 0, left) - was - ahead_us(ramp, left, lv, left);
+	state = hal_irq_save();
+	left_us += more;
+	hal_irq_restore(state);
+}
+
+void motion_home(void)
+{
+	angle = 0;
+	owed = 0;
+	unseen = -1;
+	since_seen = 0;
+	lost = 0;
+
+	// Found by a seek move; brake as hard as the ramp allows and have the
+	// next move take back the overshoot
+	if(busy)
+	{
+		if(remaining > level) remaining = level;
+		owed = (move_direction == CW) ? -(int16_t)remaining : remaining;
+	}
+}
+
+uint8_t motion_lost(void)
+{
+	return lost;
+}
+
+int16_t motion_home_check(void)
+{
+	int16_t rev = MOTION_REV * microsteps;
+	int16_t slip = (angle > rev / 2) ? angle - rev : angle;
+
+	unseen = -1;
+	since_seen = 0;
+
+	// The sensor edge is narrower than a full step, but where in it the
+	// rotor is depends on the direction and mode
+	if(slip > -(int16_t)microsteps && slip < (int16_t)microsteps) return 0;
+
+	// The rotor is at the sensor and 'slip' steps short of the commanded
+	// angle clockwise. Cover them in the move under way if that does not
+	// cut its braking short, else in the next one.
+	angle = 0;
+	int16_t fix = (move_direction == CW) ? slip : -slip;
+	if(busy && (int16_t)remaining + fix >= level)
+	{
+		remaining += fix;
+		left_us += (int32_t)fix * interval;
+	}
+	else
+	{
+		owed += slip;
+	}
+	return slip;
+}
+
+void motion_tick(void)
+{
+	// Hold the current phase and try again after the same interval
+	if(held) return;
+
+	left_us -= interval;
+	if(remaining == 0)
+	{
+		// Last interval has elapsed
+		hal_timer_irq_disable(HAL_TIMER_STEPPER);
+		last_us = (clock_now() - started) * (1000000UL / CLOCK_HZ);
+		busy = 0;
+		return;
+	}
+
+	step(move_direction);
+	remaining--;
+	level = next_level(ramp, level, remaining);
+	interval = ramp->ramp[level];
+	hal_timer_set_top(HAL_TIMER_STEPPER, interval);
+}
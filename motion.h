@@ -0,0 +1,62 @@
+/*
+ * motion.h
+ *
+ * Interrupt-driven stepper motion engine. A move command is a direction, a
+ * step count and an acceleration profile (profile.h). Timer1 runs at 1MHz
+ * in CTC mode and ISR(TIMER1_COMPA_vect) issues one step per compare match,
+ * reloading OCR1A with the next interval, so the caller is free while the
+ * dish turns.
+ *
+ * The coils can be driven in full steps, or in half steps by energising one
+ * coil between each pair of two-coil positions. Step counts and positions
+ * given to the engine are always in full steps and are scaled by the mode,
+ * so callers do not change with it. Microstepping would need the coil
+ * enables (PA0, PA3) on PWM outputs, which this wiring does not have.
+ *
+ * The engine also keeps the dish angle it has commanded, in motor steps
+ * from home. Each time the homing sensor fires it is checked against the
+ * sensor's position; a rotor that has slipped is put right by lengthening
+ * or shortening the move under way, or the next one. If the dish passes
+ * home by a quarter turn without the sensor firing at all, the engine
+ * flags itself lost and the dish must be homed again.
+ */
+
+
+#ifndef MOTION_H_
+#define MOTION_H_
+
+#include <stdint.h>
+#include "profile.h"
+
+#define CW	0	// Stepper position increasing
+#define CCW	1	// Stepper position decreasing
+
+#define MOTION_REV	200	// Full steps per dish revolution
+
+// Drive modes, the value is motor steps per full step
+#define MOTION_FULL	1
+#define MOTION_HALF	2
+
+void	motion_init	(void);
+void	motion_mode	(uint8_t mode);		// MOTION_FULL or MOTION_HALF, only while idle
+uint8_t	motion_microsteps(void);		// Motor steps per full step in the current mode
+char	motion_start	(uint8_t direction, uint16_t steps, const profile *p);	// Returns 0 if busy, 'p' must be built for the mode and not change until done
+char	motion_correct	(const profile *p);	// Make up for slip owed to the next move with a move of its own, 0 if none is owed or busy
+int16_t	motion_owed	(void);			// Motor steps clockwise owed to the next move
+void	motion_step	(uint8_t direction);	// One immediate motor step, only while idle
+uint8_t	motion_busy	(void);			// Non-zero until the last interval has elapsed
+uint32_t	motion_remaining(void);		// Microseconds until the move ends, at most one interval over
+uint32_t	motion_last_us	(void);		// Measured duration of the last finished move
+char	motion_extend	(uint8_t direction, uint16_t steps);	// Add steps without stopping, 0 if idle or reversing
+
+// Microseconds until the dish is more than 'ahead' steps past where it is
+// headed now, if the move in progress were extended by 'extra' steps now,
+// or if idle, a move of 'extra' steps with profile 'p' started now
+uint32_t	motion_reach_us	(const profile *p, uint16_t extra, uint16_t ahead);
+void	motion_hold	(uint8_t hold);		// Freeze a move in place, e.g. while paused
+void	motion_home	(void);			// Dish is at the homing sensor, ISR context; a move under way brakes to a stop
+uint8_t	motion_lost	(void);			// Non-zero from a missed homing sensor until motion_home()
+int16_t	motion_home_check(void);		// Homing sensor fired again, returns the motor steps slipped, ISR context
+void	motion_tick	(void);			// Timer1 compare match, ISR context
+
+#endif /* MOTION_H_ */
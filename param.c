@@ -0,0 +1,249 @@
+#include <string.h>
+
+#include "param.h"
+#include "uart.h"
+
+#define PARAM_NOWHERE	0xFF	// Index in answers not about one parameter
+#define PARAM_ROOM	(UART_TX_SLOTS / 2)	// UART ring kept free for telemetry, bytes
+
+static const param *params;
+static uint8_t count = 0;
+
+// Command line being read, and whether it outgrew the buffer
+static char line[PARAM_LINE + 1];
+static uint8_t length = 0;
+static uint8_t overlong = 0;
+
+// Sets waiting for param_apply(), and answers owed, one bit per parameter
+static uint16_t pending = 0;
+static uint16_t wanted[PARAM_MAX];
+static uint16_t applied = 0;
+static uint16_t asked = 0;
+
+// One error answer owed. No further lines are read until it has gone out.
+static uint8_t error = 0;
+static uint8_t error_index;
+static uint16_t error_value;
+static char error_word[PARAM_LINE + 1];
+
+void param_table(const param *table, uint8_t n)
+{
+	params = table;
+	count = n < PARAM_MAX ? n : PARAM_MAX;
+}
+
+static char answer(uint8_t status, uint8_t index, uint16_t value, const char *name)
+{
+	uint8_t frame[4 + 8 + PARAM_LINE + 1];
+	uint8_t n = strlen(name);
+	uint16_t min = 0, max = 0;
+
+	// A long list goes out a few answers at a time between frames
+	if(uart_free() < 12 + n + PARAM_ROOM) return 0;
+
+	if(index != PARAM_NOWHERE)
+	{
+		min = params[index].min;
+		max = params[index].max;
+	}
+
+	frame[0] = 'T';
+	frame[1] = 'P';
+	frame[2] = 8 + n;
+	frame[3] = status;
+	frame[4] = index;
+	frame[5] = value;
+	frame[6] = value >> 8;
+	frame[7] = min;
+	frame[8] = min >> 8;
+	frame[9] = max;
+	frame[10] = max >> 8;
+	memcpy(&frame[11], name, n);
+
+	frame[11 + n] = -uart_sum(0, &frame[2], 9 + n);
+
+	return uart_send(frame, 12 + n);
+}
+
+static void fail(uint8_t status, uint8_t index, uint16_t value, const char *word)
+{
+	error = status;
+	error_index = index;
+	error_value = value;
+	strncpy(error_word, word, PARAM_LINE);
+	error_word[PARAM_LINE] = 0;
+}
+
+// Owed answers, oldest kind first, until the UART ring is too full
+static char answer_owed(void)
+{
+	if(error)
+	{
+		if(!answer(error, error_index, error_value, error_word)) return 0;
+		error = 0;
+	}
+	for(uint8_t i = 0; i < count; i++)
+	{
+		uint16_t bit = 1U << i;
+
+		if(applied & bit)
+		{
+			if(!answer(PARAM_SET, i, *params[i].value, params[i].name)) return 0;
+			applied &= ~bit;
+		}
+		if(asked & bit)
+		{
+			if(!answer(PARAM_VALUE, i, *params[i].value, params[i].name)) return 0;
+			asked &= ~bit;
+		}
+	}
+	return 1;
+}
+
+static uint8_t find(const char *name)
+{
+	for(uint8_t i = 0; i < count; i++)
+	{
+		if(!strcmp(params[i].name, name)) return i;
+	}
+	return PARAM_NOWHERE;
+}
+
+// Decimal, at most 65535; returns 0 if the word is anything else
+static char number(const char *word, uint16_t *value)
+{
+	uint32_t v = 0;
+
+	if(!*word) return 0;
+	for(; *word; word++)
+	{
+		if(*word < '0' || *word > '9') return 0;
+		v = v * 10 + (*word - '0');
+		if(v > 0xFFFF) return 0;
+	}
+	*value = v;
+	return 1;
+}
+
+static void command(void)
+{
+	char *words[4];
+	uint8_t n = 0;
+	char *p = line;
+
+	if(overlong)
+	{
+		fail(PARAM_SYNTAX, PARAM_NOWHERE, 0, line);
+		return;
+	}
+
+	// Split on spaces in place
+	while(*p && n < 4)
+	{
+		while(*p == ' ' || *p == '\t') *p++ = 0;
+		if(!*p) break;
+		words[n++] = p;
+		while(*p && *p != ' ' && *p != '\t') p++;
+	}
+	if(!n) return;
+
+	if(n == 1 && !strcmp(words[0], "list"))
+	{
+		asked = (1UL << count) - 1;
+		return;
+	}
+	if(n >= 2 && n <= 3 && (!strcmp(words[0], "get") || !strcmp(words[0], "set")))
+	{
+		uint8_t i = find(words[1]);
+		uint16_t value;
+
+		if(i == PARAM_NOWHERE)
+		{
+			fail(PARAM_UNKNOWN, PARAM_NOWHERE, 0, words[1]);
+			return;
+		}
+		if(words[0][0] == 'g' && n == 2)
+		{
+			asked |= 1U << i;
+			return;
+		}
+		if(words[0][0] == 's' && n == 3 && number(words[2], &value))
+		{
+			if(value < params[i].min || value > params[i].max)
+			{
+				fail(PARAM_RANGE, i, value, params[i].name);
+				return;
+			}
+			if(params[i].allowed && !params[i].allowed(&params[i], value))
+			{
+				fail(PARAM_CONFLICT, i, value, params[i].name);
+				return;
+			}
+			wanted[i] = value;
+			pending |= 1U << i;
+			return;
+		}
+	}
+
+	// Echo the line as it came, spaces and all
+	for(uint8_t k = 0; k < length; k++)
+	{
+		if(!line[k]) line[k] = ' ';
+	}
+	fail(PARAM_SYNTAX, PARAM_NOWHERE, 0, line);
+}
+
+void param_poll(void)
+{
+	uint8_t byte;
+
+	if(!answer_owed()) return;
+
+	while(!error && uart_read(&byte))
+	{
+		if(byte == '\n' || byte == '\r')
+		{
+			line[length] = 0;
+			if(length || overlong) command();
+			length = 0;
+			overlong = 0;
+			if(!answer_owed()) return;
+		}
+		else if(length < PARAM_LINE)
+		{
+			line[length++] = byte;
+		}
+		else
+		{
+			overlong = 1;
+		}
+	}
+}
+
+char param_pending(void)
+{
+	return pending != 0;
+}
+
+void param_apply(void)
+{
+	for(uint8_t i = 0; i < count; i++)
+	{
+		uint16_t bit = 1U << i;
+
+		if(!(pending & bit)) continue;
+		*params[i].value = wanted[i];
+		pending &= ~bit;
+		applied |= bit;
+		if(params[i].changed) params[i].changed();
+	}
+}
+
+uint16_t param_next(const uint16_t *value)
+{
+	for(uint8_t i = 0; i < count; i++)
+	{
+		if(params[i].value == value && (pending & (1U << i))) return wanted[i];
+	}
+	return *value;
+}
@@ -0,0 +1,53 @@
+/*
+ * param.h
+ *
+ * Run-time parameters and the serial protocol that reads and changes them.
+ * Commands are text lines on USART0:
+ *
+ *   list			every parameter
+ *   get <name>
+ *   set <name> <value>		decimal
+ *
+ * A set is checked against the parameter's range, and against the values
+ * other parameters will have by then, straight away, but only takes effect
+ * when the main loop calls param_apply() between items.
+ * Every answer is a frame, little endian: 'T' 'P', length, status, index,
+ * value, min and max (16 bits each), the name, then a byte that brings the
+ * sum of every byte after 'T' 'P' to zero. Answers wait for room in the
+ * UART ring rather than the other way round, and leave half of it to
+ * telemetry.
+ */
+
+
+#ifndef PARAM_H_
+#define PARAM_H_
+
+#include <stdint.h>
+
+#define PARAM_MAX	16	// Parameters in a table, at most
+#define PARAM_LINE	32	// Longest command line
+
+// Answer status
+#define PARAM_VALUE	0	// Current value, for list and get
+#define PARAM_SET	1	// A set has taken effect
+#define PARAM_UNKNOWN	2	// No parameter by that name, the name is echoed
+#define PARAM_RANGE	3	// Value out of range, nothing changed
+#define PARAM_SYNTAX	4	// Not a command, the line is echoed
+#define PARAM_CONFLICT	5	// Value in range but at odds with another parameter, nothing changed
+
+typedef struct param{
+	const char *name;
+	uint16_t *value;
+	uint16_t min;
+	uint16_t max;
+	char (*allowed)(const struct param *p, uint16_t value);	// Checks a value in range against other parameters, or 0
+	void (*changed)(void);	// Called once a set has taken effect, or 0
+} param;
+
+void	param_table	(const param *table, uint8_t count);
+void	param_poll	(void);		// Main loop, reads commands and sends answers without waiting
+char	param_pending	(void);		// A set is waiting for param_apply()
+void	param_apply	(void);		// Between items
+uint16_t param_next	(const uint16_t *value);	// What a parameter will be once pending sets apply
+
+#endif /* PARAM_H_ */
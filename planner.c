@@ -0,0 +1,92 @@
+#include "planner.h"
+#include "motion.h"
+
+uint16_t turn_move_ms[TURN_TYPES];
+uint16_t turn_settle_ms[TURN_TYPES];
+
+// Bin index clockwise from home, or -1
+static int8_t bin_of(char type)
+{
+	switch(type)
+	{
+		case 'b': return 0;
+		case 'a': return 1;
+		case 'w': return 2;
+		case 's': return 3;
+	}
+	return -1;
+}
+
+// Move one bin to another. 'reverse' picks the other way round for a half
+// turn and is ignored otherwise. Updates *direction.
+static void single(int8_t from, int8_t to, uint8_t reverse, uint8_t *direction, plan *p)
+{
+	switch((to - from) & 0x03)
+	{
+		case 0:
+			p->steps = 0;
+			p->direction = *direction;
+			p->turn = TURN_NONE;
+			break;
+		case 1:
+			p->steps = QUARTER_TURN;
+			p->direction = CW;
+			p->turn = TURN_QUARTER;
+			break;
+		case 2:
+			p->steps = HALF_TURN;
+			p->direction = reverse ? !*direction : *direction;
+			p->turn = TURN_HALF;
+			break;
+		case 3:
+			p->steps = QUARTER_TURN;
+			p->direction = CCW;
+			p->turn = TURN_QUARTER;
+			break;
+	}
+
+	p->cost = turn_move_ms[p->turn];
+	if(p->steps && p->direction != *direction) p->turn = TURN_REVERSAL;
+	p->cost += turn_settle_ms[p->turn];
+	if(p->steps) *direction = p->direction;
+}
+
+char plan_move(char location, uint8_t last_direction, const char *types, uint8_t n, plan *p)
+{
+	int8_t bins[PLAN_LOOKAHEAD];
+	uint32_t best_cost = 0xFFFFFFFF;
+	uint8_t best = 0;
+
+	if(n > PLAN_LOOKAHEAD) n = PLAN_LOOKAHEAD;
+	for(uint8_t i = 0; i < n; i++)
+	{
+		bins[i] = bin_of(types[i]);
+		if(bins[i] < 0) n = i;
+	}
+	if(n == 0 || bin_of(location) < 0) return 0;
+
+	// Bit i of 'choice' reverses the half turn to item i, if it is one.
+	// Choice 0 keeps the current direction and wins ties.
+	for(uint8_t choice = 0; choice < (1 << n); choice++)
+	{
+		int8_t at = bin_of(location);
+		uint8_t direction = last_direction;
+		uint32_t cost = 0;
+		plan step;
+
+		for(uint8_t i = 0; i < n; i++)
+		{
+			single(at, bins[i], (choice >> i) & 1, &direction, &step);
+			cost += step.cost;
+			at = bins[i];
+		}
+		if(cost < best_cost)
+		{
+			best_cost = cost;
+			best = choice;
+		}
+	}
+
+	single(bin_of(location), bins[0], best & 1, &last_direction, p);
+	return 1;
+}
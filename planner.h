@@ -0,0 +1,46 @@
+/*
+ * planner.h
+ *
+ * Dish rotation planner. Bins sit a quarter turn apart, clockwise from
+ * home: black, aluminium, white, steel. Quarter turns have only one sensible
+ * direction but a half turn can go either way, and turning against the
+ * previous move costs a longer settle. For each move the planner tries every
+ * direction choice over the next few queued items and keeps the cheapest
+ * sequence under a cost table the caller fills in.
+ */
+
+
+#ifndef PLANNER_H_
+#define PLANNER_H_
+
+#include <stdint.h>
+
+#define QUARTER_TURN	50	// Full steps between neighbouring bins
+#define HALF_TURN	100
+
+#define PLAN_LOOKAHEAD	4	// Queued items considered per move, at most 8
+
+// Turn types, index the cost tables
+#define TURN_NONE	0
+#define TURN_QUARTER	1
+#define TURN_HALF	2
+#define TURN_REVERSAL	3	// Any turn against the previous direction
+#define TURN_TYPES	4
+
+typedef struct plan{
+	uint8_t direction;	// CW or CCW
+	uint8_t steps;		// Full steps, 0 if the dish is already there
+	uint8_t turn;		// TURN_* type, selects the settle time
+	uint16_t cost;		// Expected ms from start until the dish has settled
+} plan;
+
+// Cost model in ms. Moving time is indexed by NONE/QUARTER/HALF, settle time
+// by any turn type.
+extern uint16_t turn_move_ms[TURN_TYPES];
+extern uint16_t turn_settle_ms[TURN_TYPES];
+
+// Plan the move from 'location' to types[0], given the previous direction
+// and up to PLAN_LOOKAHEAD upcoming item types. Returns 0 for an unknown type.
+char plan_move(char location, uint8_t last_direction, const char *types, uint8_t n, plan *p);
+
+#endif /* PLANNER_H_ */
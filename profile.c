@@ -0,0 +1,104 @@
+#include "hal.h"
+#include "profile.h"
+
+// Newton iterations per step, plenty for a cubic this well behaved
+#define PROFILE_NEWTON	4
+
+// Where the tuned profile is kept in EEPROM, and the mark that one is
+#define PROFILE_NV_ADDR		0
+#define PROFILE_NV_MAGIC	0xA5
+
+profile_params profile_presets[PROFILES] = {
+	{ 50, 133, 800, 10000 },	// Slow, 20ms to 7.5ms
+	{ 59, 167, 1000, 15000 },	// Medium, 17ms to 6ms
+	{ 67, 167, 1500, 30000 },	// Fast, 15ms to 6ms
+	{ 67, 167, 1500, 30000 },	// Tuned
+};
+
+typedef struct stored_profile{
+	uint8_t magic;
+	profile_params params;
+	uint16_t check;		// Sum of the fields, so a torn write is not used
+} stored_profile;
+
+static uint16_t checksum(const profile_params *params)
+{
+	return params->start + params->cruise + params->accel + (uint16_t)params->jerk + (uint16_t)(params->jerk >> 16);
+}
+
+// Each step is integrated exactly under a constant jerk: from rate v and
+// acceleration a, the step takes the t that solves v t + a t^2/2 + j t^3/6
+// = 1. The jerk is +J until the acceleration limit, 0 while at it, and -J
+// once the rate still to gain is what bringing the acceleration back to
+// zero would add (a^2/2J), so the rate arrives at cruise with a = 0.
+// The parameters are in full steps; the ramp is in motor steps, so a half
+// step profile has twice the rates and about twice the length.
+void profile_build(profile *p, const profile_params *params, uint8_t microsteps)
+{
+	float v = (float)params->start * microsteps;
+	float a = 0.0f;
+	float vmax = (float)params->cruise * microsteps;
+	float amax = (float)params->accel * microsteps;
+	float jmax = (float)params->jerk * microsteps;
+	uint8_t n = 0;
+
+	while(n < PROFILE_RAMP - 1 && v < vmax)
+	{
+		float j;
+		float t = 1.0f / v;
+
+		if((vmax - v) * 2.0f * jmax <= a * a) j = -jmax;
+		else if(a < amax) j = jmax;
+		else j = 0.0f;
+
+		for(uint8_t i = 0; i < PROFILE_NEWTON; i++)
+		{
+			float f = v * t + a * t * t / 2.0f + j * t * t * t / 6.0f - 1.0f;
+			float df = v + a * t + j * t * t / 2.0f;
+			t -= f / df;
+		}
+
+		v += a * t + j * t * t / 2.0f;
+		a += j * t;
+		if(a < 0.0f) a = 0.0f;
+		if(a > amax) a = amax;
+		if(v > vmax) v = vmax;
+
+		p->ramp[n++] = t * 1000000.0f;
+	}
+
+	// Cruise
+	p->ramp[n++] = 1000000.0f / v;
+	p->length = n;
+	p->microsteps = microsteps;
+}
+
+uint32_t profile_move_us(const profile *p, uint16_t steps)
+{
+	uint32_t us = 0;
+
+	steps *= p->microsteps;
+
+	for(uint16_t k = 0; k < steps; k++) us += profile_interval(p, k, steps);
+	return us;
+}
+
+void profile_store(const profile_params *params)
+{
+	stored_profile s;
+
+	s.magic = PROFILE_NV_MAGIC;
+	s.params = *params;
+	s.check = checksum(params);
+	hal_nv_write(PROFILE_NV_ADDR, &s, sizeof(s));
+}
+
+char profile_load(profile_params *params)
+{
+	stored_profile s;
+
+	hal_nv_read(PROFILE_NV_ADDR, &s, sizeof(s));
+	if(s.magic != PROFILE_NV_MAGIC || s.check != checksum(&s.params)) return 0;
+	*params = s.params;
+	return 1;
+}
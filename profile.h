@@ -0,0 +1,60 @@
+/*
+ * profile.h
+ *
+ * Jerk-limited (S-curve) acceleration profiles for the dish stepper. A
+ * profile is built at run time from a start rate, a cruise rate, an
+ * acceleration and a jerk limit into a table of step intervals for the
+ * ramp up only. Any move length then reads the ramp forwards to
+ * accelerate, cruises on its last entry and reads it backwards to stop, so
+ * one short table serves every move and a new profile needs no reflash.
+ *
+ * The tuning mode finds the fastest profile the dish follows reliably and
+ * stores it in EEPROM, where startup picks it up as PROFILE_TUNED.
+ */
+
+
+#ifndef PROFILE_H_
+#define PROFILE_H_
+
+#include <stdint.h>
+
+#define PROFILE_RAMP	64	// Longest ramp in motor steps, a slower one cruises on its last interval
+
+// Presets, index profile_presets[]
+#define PROFILE_SLOW	0
+#define PROFILE_MEDIUM	1
+#define PROFILE_FAST	2
+#define PROFILE_TUNED	3	// Loaded from EEPROM, the fast preset until tuned
+#define PROFILES	4
+
+typedef struct profile_params{
+	uint16_t start;		// Rate the motor can start and stop at, steps/s
+	uint16_t cruise;	// Top rate, steps/s
+	uint16_t accel;		// Largest acceleration, steps/s^2
+	uint32_t jerk;		// Largest change of acceleration, steps/s^3
+} profile_params;
+
+typedef struct profile{
+	uint16_t ramp[PROFILE_RAMP];	// us after each motor step of the ramp up
+	uint8_t length;			// Entries used, the last is the cruise interval
+	uint8_t microsteps;		// Motor steps per full step it was built for
+} profile;
+
+extern profile_params profile_presets[PROFILES];
+
+void		profile_build	(profile *p, const profile_params *params, uint8_t microsteps);	// Main context only, uses float
+uint32_t	profile_move_us	(const profile *p, uint16_t steps);		// Duration of a whole move of 'steps' full steps
+void		profile_store	(const profile_params *params);			// Save as the tuned profile
+char		profile_load	(profile_params *params);			// 1 if a tuned profile was saved, else untouched
+
+// Interval after motor step k of a move of 'steps' motor steps, ISR safe
+static inline uint16_t profile_interval(const profile *p, uint16_t k, uint16_t steps)
+{
+	uint16_t from_end = steps - 1 - k;
+
+	if(from_end < k) k = from_end;
+	if(k >= p->length) k = p->length - 1;
+	return p->ramp[k];
+}
+
+#endif /* PROFILE_H_ */
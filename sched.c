@@ -0,0 +1,81 @@
+#include "hal.h"
+#include "clock.h"
+#include "sched.h"
+
+typedef struct task{
+	task_fn run;
+	const char *name;
+	uint32_t period;	// Clock ticks, 0 if signalled only
+	uint32_t due;		// Clock at the next periodic run
+	uint32_t wcet;		// Longest run in clock ticks
+} task;
+
+static task tasks[SCHED_TASKS];
+static uint8_t registered = 0;
+
+// Event flags, one bit per task. Set from ISRs, taken by sched_run().
+static volatile uint16_t signalled = 0;
+
+void sched_task(uint8_t id, const char *name, task_fn run, uint16_t period)
+{
+	tasks[id].run = run;
+	tasks[id].name = name;
+	tasks[id].period = CLOCK_MS(period);
+	tasks[id].due = clock_now() + tasks[id].period;
+	tasks[id].wcet = 0;
+	if(id >= registered) registered = id + 1;
+}
+
+void sched_signal(uint8_t id)
+{
+	uint8_t state = hal_irq_save();
+	signalled |= 1U << id;
+	hal_irq_restore(state);
+}
+
+void sched_run(void)
+{
+	// Flags raised while this pass runs are seen on the next one
+	uint8_t state = hal_irq_save();
+	uint16_t flags = signalled;
+	signalled = 0;
+	hal_irq_restore(state);
+
+	for(uint8_t id = 0; id < registered; id++)
+	{
+		task *t = &tasks[id];
+		uint32_t start = clock_now();
+		
+		if(!t->run) continue;
+		if(t->period && (int32_t)(start - t->due) >= 0)
+		{
+			// Late runs are not made up for, the next is a full period on
+			t->due = start + t->period;
+		}
+		else if(!(flags & (1U << id)))
+		{
+			continue;
+		}
+		
+		t->run();
+		
+		uint32_t took = clock_now() - start;
+		if(took > t->wcet) t->wcet = took;
+	}
+}
+
+uint8_t sched_tasks(void)
+{
+	return registered;
+}
+
+const char *sched_name(uint8_t id)
+{
+	return tasks[id].name;
+}
+
+uint16_t sched_wcet_us(uint8_t id)
+{
+	uint32_t us = tasks[id].wcet * (1000000UL / CLOCK_HZ);
+	return us > 0xFFFF ? 0xFFFF : us;
+}
@@ -0,0 +1,29 @@
+/*
+ * sched.h
+ *
+ * Run-to-completion task scheduler for the main loop. Each task is a
+ * function that does a bounded amount of work and returns; it never waits.
+ * A task runs when its period comes due or when something, usually an ISR,
+ * signals its event flag, whichever is first. Tasks run in id order, so a
+ * lower id has priority within a pass. The longest run of each task is
+ * kept, in clock ticks, to show where the main loop's time goes.
+ */
+
+
+#ifndef SCHED_H_
+#define SCHED_H_
+
+#include <stdint.h>
+
+#define SCHED_TASKS	12	// At most 16, ids 0 to SCHED_TASKS - 1
+
+typedef void (*task_fn)(void);
+
+void		sched_task	(uint8_t id, const char *name, task_fn run, uint16_t period);	// Period in ms, 0 to run on signals only
+void		sched_signal	(uint8_t id);		// Any context
+void		sched_run	(void);			// One pass over the ready tasks
+uint8_t		sched_tasks	(void);			// Highest id registered, plus one
+const char	*sched_name	(uint8_t id);
+uint16_t	sched_wcet_us	(uint8_t id);		// Longest run, to the clock's 8us resolution
+
+#endif /* SCHED_H_ */
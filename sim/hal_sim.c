@@ -0,0 +1,522 @@
+/*
+ * hal_sim.c
+ *
+ * Host implementation of hal.h. Keeps the simulated clock, the AVR timers,
+ * the ADC and the interrupt flags, and calls the firmware's ISRs the way the
+ * ATmega2560 would: one at a time, highest priority first, only while
+ * interrupts are globally enabled.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hal.h"
+#include "sim.h"
+
+sim_time sim_now = 0;
+
+// Firmware ISRs. Weak so the firmware may leave any of them out.
+void INT0_vect(void) __attribute__((weak));
+void INT1_vect(void) __attribute__((weak));
+void INT2_vect(void) __attribute__((weak));
+void INT3_vect(void) __attribute__((weak));
+void INT4_vect(void) __attribute__((weak));
+void INT5_vect(void) __attribute__((weak));
+void TIMER0_OVF_vect(void) __attribute__((weak));
+void TIMER1_COMPA_vect(void) __attribute__((weak));
+void TIMER2_COMPA_vect(void) __attribute__((weak));
+void TIMER3_COMPA_vect(void) __attribute__((weak));
+void TIMER4_COMPA_vect(void) __attribute__((weak));
+void TIMER5_OVF_vect(void) __attribute__((weak));
+void ADC_vect(void) __attribute__((weak));
+void USART0_RX_vect(void) __attribute__((weak));
+void USART0_UDRE_vect(void) __attribute__((weak));
+
+static void (*const vectors[SIM_IRQ_COUNT])(void) =
+{
+	[SIM_IRQ_INT0]		= INT0_vect,
+	[SIM_IRQ_INT1]		= INT1_vect,
+	[SIM_IRQ_INT2]		= INT2_vect,
+	[SIM_IRQ_INT3]		= INT3_vect,
+	[SIM_IRQ_INT4]		= INT4_vect,
+	[SIM_IRQ_INT5]		= INT5_vect,
+	[SIM_IRQ_TIMER2]	= TIMER2_COMPA_vect,
+	[SIM_IRQ_TIMER1]	= TIMER1_COMPA_vect,
+	[SIM_IRQ_TIMER0_OVF]	= TIMER0_OVF_vect,
+	[SIM_IRQ_UART_RX]	= USART0_RX_vect,
+	[SIM_IRQ_UART_UDRE]	= USART0_UDRE_vect,
+	[SIM_IRQ_ADC]		= ADC_vect,
+	[SIM_IRQ_TIMER3]	= TIMER3_COMPA_vect,
+	[SIM_IRQ_TIMER4]	= TIMER4_COMPA_vect,
+	[SIM_IRQ_TIMER5_OVF]	= TIMER5_OVF_vect,
+};
+
+static uint8_t irq_flag[SIM_IRQ_COUNT];
+static uint8_t irq_mask[SIM_IRQ_COUNT];
+static uint8_t irq_global = 0;
+static uint8_t in_isr = 0;
+
+// Timers 0-5. Tick lengths follow the prescalers set up in hal_init().
+// Timers 1-4 run in CTC mode. Timer0 (8-bit PWM) and timer5 run free with
+// a fixed TOP, so their only event is the overflow.
+struct sim_timer
+{
+	sim_time	tick;
+	uint16_t	top;
+	sim_time	cycle;		// Start of the current count cycle
+	sim_time	next;		// Next compare match
+	int		irq;
+};
+
+static struct sim_timer timers[6] =
+{
+	[0] = { 1 * SIM_US,	0xFF,	0, 0, SIM_IRQ_TIMER0_OVF },
+	[1] = { 1 * SIM_US,	0xFFFF,	0, 0, SIM_IRQ_TIMER1 },
+	[2] = { 4 * SIM_US,	250,	0, 0, SIM_IRQ_TIMER2 },
+	[3] = { 8 * SIM_US,	0xFFFF,	0, 0, SIM_IRQ_TIMER3 },
+	[4] = { 8 * SIM_US,	0xFFFF,	0, 0, SIM_IRQ_TIMER4 },
+	[5] = { 8 * SIM_US,	0xFFFF,	0, 0, SIM_IRQ_TIMER5_OVF },
+};
+
+// ADC: 13 ADC clocks per conversion, prescaler 2 until free running mode
+// switches it to 64
+static sim_time adc_conversion = 3250;
+static int adc_free = 0;
+
+// ATmega2560 EEPROM, erased
+#define EEPROM_SIZE	4096
+static uint8_t eeprom[EEPROM_SIZE];
+
+// USART0 output, 10 bit times a byte. The data register empties as soon
+// as the shift register takes a byte, so one byte can wait behind the one
+// on the line.
+#define UART_BYTE	(10 * SIM_S / HAL_UART_BAUD)
+static FILE *uart;
+static int uart_held = 0;		// Bytes in the data and shift registers
+static sim_time uart_shifted;		// When the byte on the line is out
+
+// USART0 input from the -c file, a line at a time
+static FILE *commands;
+static char command[256];		// Line being received, newline included
+static int command_at = -1;		// Next byte of it, -1 once the file is done
+static sim_time received;		// When that byte is in
+static uint8_t uart_rx;
+static int adc_busy = 0;
+static sim_time adc_done;
+static uint16_t adc_value;
+
+// Queue the next line of the -c file, sent at its time or straight after
+// the one before
+static void next_command(void)
+{
+	double at;
+
+	command_at = -1;
+	if(!commands) return;
+	if(fscanf(commands, "%lf %254[^\n]", &at, command) != 2) return;
+	strcat(command, "\n");
+	received = (sim_time)(at * SIM_S);
+	if(received < sim_now + UART_BYTE) received = sim_now + UART_BYTE;
+	command_at = 0;
+}
+
+static sim_time timer_period(struct sim_timer *t)
+{
+	return ((sim_time)t->top + 1) * t->tick;
+}
+
+static sim_time next_event(void)
+{
+	sim_time next = plant_next_event();
+
+	for(int i = 0; i < 6; i++)
+	{
+		if(timers[i].next < next) next = timers[i].next;
+	}
+	if(adc_busy && adc_done < next) next = adc_done;
+	if(uart_held && uart_shifted < next) next = uart_shifted;
+	if(command_at >= 0 && received < next) next = received;
+
+	return next;
+}
+
+// Latch everything that is due at sim_now
+static void process_events(void)
+{
+	for(int i = 0; i < 6; i++)
+	{
+		struct sim_timer *t = &timers[i];
+		while(t->next <= sim_now)
+		{
+			irq_flag[t->irq] = 1;
+			t->cycle = t->next;
+			t->next += timer_period(t);
+		}
+	}
+
+	if(adc_busy && adc_done <= sim_now)
+	{
+		adc_value = plant_reflectance();
+		irq_flag[SIM_IRQ_ADC] = 1;
+		if(adc_free)
+		{
+			adc_done += adc_conversion;
+		}
+		else
+		{
+			adc_busy = 0;
+		}
+	}
+
+	while(uart_held && uart_shifted <= sim_now)
+	{
+		uart_held--;
+		uart_shifted += UART_BYTE;
+	}
+	irq_flag[SIM_IRQ_UART_UDRE] = uart_held < 2;
+
+	if(command_at >= 0 && received <= sim_now)
+	{
+		uart_rx = command[command_at++];
+		irq_flag[SIM_IRQ_UART_RX] = 1;
+		if(command[command_at]) received += UART_BYTE;
+		else next_command();
+	}
+
+	plant_update(sim_now);
+}
+
+// Run pending, unmasked ISRs. Flags are cleared on entry like the hardware.
+static void dispatch(void)
+{
+	int i = 0;
+
+	if(!irq_global || in_isr) return;
+
+	while(i < SIM_IRQ_COUNT)
+	{
+		if(irq_flag[i] && irq_mask[i] && vectors[i])
+		{
+			irq_flag[i] = 0;
+			in_isr = 1;
+			irq_global = 0;
+			vectors[i]();
+			irq_global = 1;
+			in_isr = 0;
+			i = 0;
+		}
+		else
+		{
+			i++;
+		}
+	}
+}
+
+void sim_advance(sim_time dt)
+{
+	sim_time target = sim_now + dt;
+
+	while(1)
+	{
+		sim_time next = next_event();
+		if(next > target) break;
+		if(next > sim_now) sim_now = next;
+		process_events();
+		dispatch();
+	}
+
+	// A nested ISR may already have carried time past the target
+	if(sim_now < target) sim_now = target;
+	process_events();
+	dispatch();
+
+	if(sim_now > (sim_time)(sim_opt.limit * SIM_S))
+	{
+		printf("sim: time limit of %.0fs reached\n", sim_opt.limit);
+		hal_halt();
+	}
+}
+
+void sim_irq_raise(int irq)
+{
+	irq_flag[irq] = 1;
+}
+
+void hal_init(void)
+{
+	for(int i = 0; i < 6; i++)
+	{
+		timers[i].cycle = sim_now;
+		timers[i].next = sim_now + timer_period(&timers[i]);
+	}
+	plant_init();
+
+	memset(eeprom, 0xFF, sizeof(eeprom));
+	if(sim_opt.eeprom)
+	{
+		FILE *f = fopen(sim_opt.eeprom, "rb");
+		if(f)
+		{
+			if(fread(eeprom, 1, sizeof(eeprom), f) == 0) memset(eeprom, 0xFF, sizeof(eeprom));
+			fclose(f);
+		}
+	}
+
+	if(sim_opt.uart)
+	{
+		uart = fopen(sim_opt.uart, "wb");
+		if(!uart) perror(sim_opt.uart);
+	}
+	if(sim_opt.commands)
+	{
+		commands = fopen(sim_opt.commands, "r");
+		if(!commands) perror(sim_opt.commands);
+		next_command();
+	}
+
+	// ADC interrupt enabled and belt lines set to run, as on the target
+	irq_mask[SIM_IRQ_ADC] = 1;
+	plant_belt(1);
+}
+
+void hal_idle(void)
+{
+	sim_time next = next_event();
+
+	if(next < sim_now + SIM_POLL) next = sim_now + SIM_POLL;
+	if(next > sim_now + SIM_MS) next = sim_now + SIM_MS;
+	sim_advance(next - sim_now);
+}
+
+void hal_halt(void)
+{
+	if(uart) fclose(uart);
+	lcd_sim_dump();
+	plant_report();
+	exit(0);
+}
+
+// About 3.4ms per byte written on the target; not worth modelling
+void hal_nv_read(uint16_t addr, void *buf, uint16_t len)
+{
+	sim_advance(SIM_POLL);
+	if(addr + len > EEPROM_SIZE) return;
+	memcpy(buf, &eeprom[addr], len);
+}
+
+void hal_nv_write(uint16_t addr, const void *buf, uint16_t len)
+{
+	sim_advance(SIM_POLL);
+	if(addr + len > EEPROM_SIZE) return;
+	memcpy(&eeprom[addr], buf, len);
+	if(!sim_opt.eeprom) return;
+
+	FILE *f = fopen(sim_opt.eeprom, "wb");
+	if(!f)
+	{
+		perror(sim_opt.eeprom);
+		return;
+	}
+	fwrite(eeprom, 1, sizeof(eeprom), f);
+	fclose(f);
+}
+
+void hal_uart_init(void)
+{
+	sim_advance(SIM_POLL);
+	irq_mask[SIM_IRQ_UART_RX] = 1;
+}
+
+uint8_t hal_uart_recv(void)
+{
+	sim_advance(SIM_POLL);
+	return uart_rx;
+}
+
+void hal_uart_send(uint8_t byte)
+{
+	sim_advance(SIM_POLL);
+	if(uart_held == 0) uart_shifted = sim_now + UART_BYTE;
+	if(uart_held < 2) uart_held++;
+	irq_flag[SIM_IRQ_UART_UDRE] = uart_held < 2;
+	if(uart) fputc(byte, uart);
+}
+
+void hal_uart_irq_enable(void)
+{
+	sim_advance(SIM_POLL);
+	irq_mask[SIM_IRQ_UART_UDRE] = 1;
+}
+
+void hal_uart_irq_disable(void)
+{
+	sim_advance(SIM_POLL);
+	irq_mask[SIM_IRQ_UART_UDRE] = 0;
+}
+
+void hal_delay_us(uint16_t us)
+{
+	sim_advance(us * SIM_US);
+}
+
+uint8_t hal_irq_save(void)
+{
+	uint8_t state = irq_global;
+
+	irq_global = 0;
+	return state;
+}
+
+void hal_irq_restore(uint8_t state)
+{
+	irq_global = state;
+	if(state) sim_advance(SIM_POLL);
+}
+
+void hal_belt_run(void)
+{
+	sim_advance(SIM_POLL);
+	plant_belt(1);
+}
+
+void hal_belt_brake(void)
+{
+	sim_advance(SIM_POLL);
+	plant_belt(0);
+}
+
+void hal_belt_duty(uint8_t percent)
+{
+	sim_advance(SIM_POLL);
+	plant_belt_duty(percent);
+}
+
+void hal_stepper_write(uint8_t pattern)
+{
+	sim_advance(SIM_POLL);
+	plant_stepper(pattern);
+}
+
+uint8_t hal_optic_active(void)
+{
+	sim_advance(SIM_POLL);
+	return plant_optic();
+}
+
+void hal_adc_start(void)
+{
+	sim_advance(SIM_POLL);
+	if(!adc_busy)
+	{
+		adc_busy = 1;
+		adc_done = sim_now + adc_conversion;
+	}
+}
+
+void hal_adc_free_run(void)
+{
+	sim_advance(SIM_POLL);
+	adc_conversion = 13 * 8 * SIM_US;
+	adc_free = 1;
+	adc_busy = 1;
+	adc_done = sim_now + adc_conversion;
+}
+
+uint16_t hal_adc_read(void)
+{
+	return adc_value;
+}
+
+void hal_timer_set_top(uint8_t timer, uint16_t top)
+{
+	struct sim_timer *t = &timers[timer];
+
+	sim_advance(SIM_POLL);
+	t->top = top;
+	t->next = t->cycle + timer_period(t);
+	if(t->next <= sim_now) t->next = sim_now + t->tick;
+}
+
+void hal_timer_restart(uint8_t timer)
+{
+	struct sim_timer *t = &timers[timer];
+
+	sim_advance(SIM_POLL);
+	t->cycle = sim_now;
+	t->next = sim_now + timer_period(t);
+	irq_flag[t->irq] = 0;
+}
+
+uint8_t hal_timer_expired(uint8_t timer)
+{
+	sim_advance(SIM_POLL);
+	return irq_flag[timers[timer].irq];
+}
+
+void hal_timer_clear(uint8_t timer)
+{
+	sim_advance(SIM_POLL);
+	irq_flag[timers[timer].irq] = 0;
+}
+
+uint16_t hal_timer_count(uint8_t timer)
+{
+	struct sim_timer *t = &timers[timer];
+
+	sim_advance(SIM_POLL);
+	return (sim_now - t->cycle) / t->tick;
+}
+
+void hal_timer_irq_enable(uint8_t timer)
+{
+	sim_advance(SIM_POLL);
+	irq_mask[timers[timer].irq] = 1;
+}
+
+void hal_timer_irq_disable(uint8_t timer)
+{
+	sim_advance(SIM_POLL);
+	irq_mask[timers[timer].irq] = 0;
+}
+
+void hal_timer_ovf_enable(uint8_t timer)
+{
+	sim_advance(SIM_POLL);
+	irq_mask[timers[timer].irq] = 1;
+}
+
+uint8_t hal_timer_ovf_pending(uint8_t timer)
+{
+	sim_advance(SIM_POLL);
+	return irq_flag[timers[timer].irq];
+}
+
+void hal_extint_enable(uint8_t num)
+{
+	irq_mask[SIM_IRQ_INT0 + num] = 1;
+	sim_advance(SIM_POLL);
+}
+
+void hal_extint_disable(uint8_t num)
+{
+	irq_mask[SIM_IRQ_INT0 + num] = 0;
+	sim_advance(SIM_POLL);
+}
+
+void hal_extint_clear(uint8_t num)
+{
+	irq_flag[SIM_IRQ_INT0 + num] = 0;
+	sim_advance(SIM_POLL);
+}
+
+void hal_sei(void)
+{
+	irq_global = 1;
+	sim_advance(SIM_POLL);
+}
+
+void hal_cli(void)
+{
+	irq_global = 0;
+}
@@ -0,0 +1,114 @@
+/*
+ * lcd_sim.c
+ *
+ * HD44780 model standing in for the pin-level half of LCD.c. Commands and
+ * data land in a DDRAM image. Blocking writes cost the CPU the time the
+ * busy flag would have held it; nibble writes are checked against the
+ * display still being busy with the previous byte instead.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "lcd.h"
+#include "sim.h"
+
+#define LCD_COLS	16
+#define LCD_LINE	40	// DDRAM per line
+
+static char ddram[2][LCD_LINE];
+static uint8_t address = 0;
+static int dirty = 0;
+static sim_time last_log = 0;
+
+static int half = 0;			// High nibble received
+static uint8_t high;
+static sim_time busy_until = 0;
+static unsigned overruns = 0;		// Bytes sent while the display was busy
+static unsigned overruns_shown = 0;
+
+static void lcd_clear(void)
+{
+	memset(ddram, ' ', sizeof(ddram));
+	address = 0;
+	dirty = 1;
+}
+
+void InitLCD(uint8_t style)
+{
+	(void)style;
+	sim_advance(30 * SIM_MS);
+	lcd_clear();
+}
+
+void LCDBusyLoop(void)
+{
+}
+
+// Execute a byte, returns how long the display stays busy
+static sim_time execute(uint8_t c, uint8_t isdata)
+{
+	if(isdata)
+	{
+		int line = (address & 0x40) ? 1 : 0;
+		int col = address & 0x3F;
+		if(col < LCD_LINE) ddram[line][col] = c;
+		address = (address & 0x40) | ((col + 1) % LCD_LINE);
+		dirty = 1;
+		return 43 * SIM_US;
+	}
+	else if(c == 0x01)
+	{
+		lcd_clear();
+		return 1520 * SIM_US;
+	}
+	else if((c & 0xFE) == 0x02)
+	{
+		address = 0;
+		return 1520 * SIM_US;
+	}
+	else
+	{
+		if(c & 0x80) address = c & 0x7F;
+		return 37 * SIM_US;
+	}
+}
+
+void LCDByte(uint8_t c, uint8_t isdata)
+{
+	sim_advance(execute(c, isdata));
+	busy_until = sim_now;
+}
+
+void LCDNibble(uint8_t n, uint8_t isdata)
+{
+	sim_advance(3 * SIM_US);
+	if(!half)
+	{
+		high = n & 0x0F;
+		half = 1;
+		return;
+	}
+	half = 0;
+	if(sim_now < busy_until) overruns++;
+	busy_until = sim_now + execute((high << 4) | (n & 0x0F), isdata);
+}
+
+void lcd_sim_dump(void)
+{
+	printf("%10.3f |%.*s|%.*s|\n", (double)sim_now / SIM_S,
+		LCD_COLS, ddram[0], LCD_COLS, ddram[1]);
+	if(overruns != overruns_shown) printf("lcd: %u bytes sent while the display was busy\n", overruns);
+	overruns_shown = overruns;
+	dirty = 0;
+	last_log = sim_now;
+}
+
+// Log the display at most every 10ms while it keeps changing
+void lcd_sim_poll(sim_time now)
+{
+	if(sim_opt.log_lcd && dirty && now - last_log >= 10 * SIM_MS)
+	{
+		lcd_sim_dump();
+	}
+}
@@ -0,0 +1,452 @@
+/*
+ * plant.c
+ *
+ * Conveyor, sensor and sorting dish model.
+ *
+ * Items are dropped on the belt at the feeder, travel past the optic and
+ * reflective sensors, trip the exit sensor at the end of the belt, tip off
+ * and fall into whichever bin the dish is facing when they land. The dish
+ * is driven by decoding the stepper coil pattern the firmware writes, and
+ * misses steps when it is asked to accelerate harder than its inertia
+ * allows.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "sim.h"
+
+// Belt geometry, mm from the optic sensor
+#define LOAD_X		-100.0	// Feeder
+#define OPTIC_X		0.0	// Optic sensor beam (also the reflective sensor)
+#define EXIT_X		500.0	// Exit sensor beam
+#define END_X		515.0	// Item tips off once its centre passes here
+#define ITEM_LEN	25.0
+
+// Belt dynamics
+#define BELT_VMAX	500.0	// mm/s at 100% duty
+#define BELT_ACCEL	3000.0	// mm/s^2
+#define BELT_DECEL	8000.0	// mm/s^2 with the motor braked
+
+// Dish, in full steps (200 per revolution)
+#define DISH_STEPS	200
+#define DISH_PULL_IN	100.0	// Step rate the dish can start/stop at, steps/s
+#define DISH_VMAX	250.0	// Fastest reliable step rate, steps/s
+#define DISH_ACCEL	6000.0	// Largest step rate change, steps/s^2
+#define DISH_REST	(100 * SIM_MS)	// Dish is at rest after this long without a step
+#define BIN_TOLERANCE	12	// Full steps either side of a bin centre
+#define FALL_TIME	(60 * SIM_MS)	// From tipping off the belt to landing
+
+// Reflective sensor, ADC counts
+#define BASELINE	990.0
+#define NOISE		1.5
+
+// Plant is integrated at a fixed step
+#define TICK		(100 * SIM_US)
+
+enum { ON_FEEDER, ON_BELT, FALLING, LANDED };
+
+struct item
+{
+	char		cls;		// 'a', 's', 'w' or 'b'
+	double		min;		// Lowest reflectance the item produces
+	double		len;
+	double		front;		// Leading edge position, mm
+	int		state;
+	int		correct;
+	char		bin;		// Bin it landed in
+	sim_time	t_optic;	// Leading edge reached the optic sensor
+	sim_time	t_exit;		// Leading edge reached the exit sensor
+	sim_time	t_drop;
+	sim_time	t_land;
+};
+
+static struct item *items;
+static unsigned fed = 0;
+
+static sim_time last_tick = 0;
+
+// Belt
+static int belt_run = 0;
+static uint8_t belt_duty = 0;
+static double belt_v = 0.0;
+static unsigned belt_stops = 0;
+static sim_time belt_run_time = 0;
+static sim_time belt_first_run = 0;
+static double belt_distance = 0.0;	// mm
+static double belt_vpeak = 0.0;
+
+// Sensors
+static int optic = 0;
+static int exit_blocked = 0;
+static sim_time bounce_at = 0;
+static unsigned exit_edges = 0;
+static int ramp_pressed = 0;
+static unsigned pause_edges = 0;
+
+// Dish
+static int phase = -1;			// Electrical phase, half steps (0-7)
+static long cmd_pos = 0;		// Commanded position, half steps
+static long slip = 0;			// Rotor lag from missed steps, half steps
+static long dish_offset;		// Rotor angle at power up, half steps
+static double dish_v = 0.0;		// Step rate, full steps/s
+static sim_time last_step = 0;
+static unsigned steps = 0;
+static unsigned lost_steps = 0;
+static int home_active = 0;
+static sim_time homed_at = 0;		// First time the homing sensor fired
+
+static const double class_min[4][2] =
+{
+	// Mean, standard deviation
+	{ 120.0, 25.0 },	// Aluminium
+	{ 480.0, 60.0 },	// Steel
+	{ 870.0, 8.0 },		// White plastic
+	{ 945.0, 10.0 },	// Black plastic
+};
+static const char class_name[4] = { 'a', 's', 'w', 'b' };
+
+static uint64_t rng_state;
+
+double sim_random(void)
+{
+	// xorshift64*
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return ((rng_state * 0x2545F4914F6CDD1DULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+double sim_gauss(void)
+{
+	double u = sim_random();
+	double v = sim_random();
+
+	if(u < 1e-12) u = 1e-12;
+	return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v);
+}
+
+void plant_init(void)
+{
+	rng_state = 0x9E3779B97F4A7C15ULL ^ sim_opt.seed;
+	items = calloc(sim_opt.items ? sim_opt.items : 1, sizeof(*items));
+	for(unsigned i = 0; i < sim_opt.items; i++)
+	{
+		int c = (int)(sim_random() * 4);
+		items[i].cls = class_name[c];
+		items[i].min = class_min[c][0] + class_min[c][1] * sim_gauss();
+		items[i].len = ITEM_LEN + sim_gauss() * 0.5;
+		items[i].state = ON_FEEDER;
+	}
+	dish_offset = (long)(sim_random() * DISH_STEPS * 2);
+	last_tick = sim_now;
+}
+
+// Dish angle in half steps, 0 to 399, with the homing flag at 0
+static long dish_angle(void)
+{
+	long a = (cmd_pos + slip + dish_offset) % (DISH_STEPS * 2);
+	return a < 0 ? a + DISH_STEPS * 2 : a;
+}
+
+static char dish_bin(int *error)
+{
+	static const char bins[4] = { 'b', 'a', 'w', 's' };	// Clockwise from home
+	long full = dish_angle() / 2;
+	int bin = (int)((full + DISH_STEPS / 8) / (DISH_STEPS / 4)) % 4;
+	long e = full - bin * (DISH_STEPS / 4);
+
+	if(e > DISH_STEPS / 2) e -= DISH_STEPS;
+	*error = (int)labs(e);
+	return bins[bin];
+}
+
+static double ambient(sim_time now)
+{
+	return sim_opt.drift * sin(2.0 * M_PI * (double)now / (60.0 * SIM_S));
+}
+
+static int covers(struct item *it, double x)
+{
+	return it->state == ON_BELT && it->front >= x && it->front - it->len <= x;
+}
+
+static void tick(sim_time now)
+{
+	double dt = (double)TICK / SIM_S;
+
+	// Belt speed
+	double target = belt_run ? belt_duty * BELT_VMAX / 100.0 : 0.0;
+	if(belt_v < target)
+	{
+		belt_v += BELT_ACCEL * dt;
+		if(belt_v > target) belt_v = target;
+	}
+	else if(belt_v > target)
+	{
+		belt_v -= BELT_DECEL * dt;
+		if(belt_v < target) belt_v = target;
+	}
+	if(belt_v > 0.0 && belt_first_run) belt_run_time += TICK;
+	belt_distance += belt_v * dt;
+	if(belt_v > belt_vpeak) belt_vpeak = belt_v;
+
+	// Move items
+	for(unsigned i = 0; i < fed; i++)
+	{
+		struct item *it = &items[i];
+		if(it->state != ON_BELT) continue;
+		it->front += belt_v * dt;
+
+		if(!it->t_optic && it->front >= OPTIC_X) it->t_optic = now;
+		if(!it->t_exit && it->front >= EXIT_X) it->t_exit = now;
+		if(it->front - it->len / 2 >= END_X)
+		{
+			it->state = FALLING;
+			it->t_drop = now;
+		}
+	}
+
+	// Land falling items in whichever bin the dish faces
+	for(unsigned i = 0; i < fed; i++)
+	{
+		struct item *it = &items[i];
+		if(it->state != FALLING || now < it->t_drop + FALL_TIME) continue;
+		int error;
+		it->bin = dish_bin(&error);
+		it->correct = it->bin == it->cls && error <= BIN_TOLERANCE;
+		it->t_land = now;
+		it->state = LANDED;
+		if(sim_opt.verbose)
+		{
+			printf("%10.3f item %3u %c -> %c%s\n", (double)now / SIM_S, i,
+				it->cls, it->bin, it->correct ? "" : "  MISSORT");
+		}
+	}
+
+	// Start loading half a second after the dish first homes, then feed the
+	// next item once the previous one has moved a pitch along
+	if(fed < sim_opt.items && homed_at && now >= homed_at + 500 * SIM_MS
+		&& (fed == 0 || items[fed - 1].front - LOAD_X >= sim_opt.pitch))
+	{
+		items[fed].front = LOAD_X;
+		items[fed].state = ON_BELT;
+		fed++;
+	}
+
+	// Optic sensor, rising edge on INT5
+	int now_optic = 0;
+	for(unsigned i = 0; i < fed; i++) now_optic |= covers(&items[i], OPTIC_X);
+	if(now_optic && !optic) sim_irq_raise(SIM_IRQ_INT5);
+	optic = now_optic;
+
+	// Exit sensor, falling edge on INT4, with optional chatter
+	int now_exit = 0;
+	for(unsigned i = 0; i < fed; i++) now_exit |= covers(&items[i], EXIT_X);
+	if(now_exit && !exit_blocked)
+	{
+		sim_irq_raise(SIM_IRQ_INT4);
+		exit_edges++;
+		if(sim_random() < sim_opt.bounce)
+		{
+			bounce_at = now + (sim_time)((2.0 + 8.0 * sim_random()) * SIM_MS);
+		}
+	}
+	exit_blocked = now_exit;
+	if(bounce_at && now >= bounce_at)
+	{
+		sim_irq_raise(SIM_IRQ_INT4);
+		bounce_at = 0;
+	}
+
+	// Press ramp down a second after the last item has passed the optic sensor
+	if(!ramp_pressed && fed == sim_opt.items && fed
+		&& items[fed - 1].t_optic && now >= items[fed - 1].t_optic + SIM_S)
+	{
+		sim_irq_raise(SIM_IRQ_INT3);
+		ramp_pressed = 1;
+	}
+
+	// Pause button presses, each a rising edge followed by contact bounce
+	static const double pause_ms[] = { 0.0, 0.8, 2.5, 4.0, 2000.0, 2001.2, 2003.0 };
+	if(sim_opt.pause > 0.0 && pause_edges < sizeof(pause_ms) / sizeof(pause_ms[0])
+		&& now >= (sim_time)(sim_opt.pause * SIM_S + pause_ms[pause_edges] * SIM_MS))
+	{
+		sim_irq_raise(SIM_IRQ_INT1);
+		pause_edges++;
+	}
+
+	// Dish comes to rest
+	if(now - last_step > DISH_REST) dish_v = 0.0;
+
+	lcd_sim_poll(now);
+}
+
+sim_time plant_next_event(void)
+{
+	return last_tick + TICK;
+}
+
+void plant_update(sim_time now)
+{
+	while(last_tick + TICK <= now)
+	{
+		last_tick += TICK;
+		tick(last_tick);
+	}
+}
+
+void plant_belt(int run)
+{
+	if(run && !belt_first_run) belt_first_run = sim_now;
+	if(!run && belt_run) belt_stops++;
+	belt_run = run;
+}
+
+void plant_belt_duty(uint8_t percent)
+{
+	belt_duty = percent > 100 ? 100 : percent;
+}
+
+// PA0 enables coil A (PA1/PA2), PA3 enables coil B (PA4/PA5)
+static int decode_phase(uint8_t pattern)
+{
+	static const int phases[3][3] =
+	{
+		// B = -1, 0, +1
+		{ 5, 4, 3 },	// A = -1
+		{ 6, -1, 2 },	// A = 0
+		{ 7, 0, 1 },	// A = +1
+	};
+	int a = (pattern & 0x01) ? ((pattern >> 1) & 1) - ((pattern >> 2) & 1) : 0;
+	int b = (pattern & 0x08) ? ((pattern >> 4) & 1) - ((pattern >> 5) & 1) : 0;
+
+	return phases[a + 1][b + 1];
+}
+
+void plant_stepper(uint8_t pattern)
+{
+	int p = decode_phase(pattern);
+
+	if(p < 0) return;
+	if(phase < 0)
+	{
+		// Rotor snaps to the first energised phase
+		phase = p;
+		return;
+	}
+
+	int delta = (p - phase + 8) % 8;
+	if(delta > 4) delta -= 8;
+	phase = p;
+	if(delta == 0) return;
+
+	double dt = (double)(sim_now - last_step) / SIM_S;
+	double full = abs(delta) / 2.0;
+	double rate = dt > 0.0 ? full / dt : DISH_VMAX * 2;
+	double v = (sim_now - last_step > DISH_REST) ? 0.0 : dish_v;
+
+	cmd_pos += delta;
+	steps++;
+	last_step = sim_now;
+
+	if(delta == 4 || delta == -4 || rate > DISH_VMAX
+		|| (rate > DISH_PULL_IN && fabs(rate - v) > DISH_ACCEL * dt))
+	{
+		// Rotor falls back a whole electrical cycle and stops
+		slip -= (delta > 0) ? 8 : -8;
+		lost_steps += 4;
+		if(sim_opt.verbose)
+		{
+			printf("%10.3f dish stalled at %.0f steps/s\n", (double)sim_now / SIM_S, rate);
+		}
+		dish_v = 0.0;
+	}
+	else
+	{
+		dish_v = rate;
+	}
+
+	// Homing sensor, falling edge on INT2 as the flag enters the window
+	long a = dish_angle();
+	int now_home = a <= 1;
+	if(now_home && !home_active)
+	{
+		sim_irq_raise(SIM_IRQ_INT2);
+		if(!homed_at) homed_at = sim_now;
+	}
+	home_active = now_home;
+}
+
+uint8_t plant_optic(void)
+{
+	return optic;
+}
+
+uint16_t plant_reflectance(void)
+{
+	double value = BASELINE;
+
+	for(unsigned i = 0; i < fed; i++)
+	{
+		struct item *it = &items[i];
+		if(!covers(it, OPTIC_X)) continue;
+
+		// Flat-bottomed dip across the item
+		double u = (it->front - OPTIC_X) / it->len;
+		double depth = 1.6 * sin(M_PI * u);
+		if(depth > 1.0) depth = 1.0;
+		value = BASELINE - depth * (BASELINE - it->min);
+	}
+
+	value += ambient(sim_now) + NOISE * sim_gauss();
+	if(value < 0.0) value = 0.0;
+	if(value > 1023.0) value = 1023.0;
+	return (uint16_t)value;
+}
+
+static int cmp_time(const void *a, const void *b)
+{
+	sim_time x = *(const sim_time *)a;
+	sim_time y = *(const sim_time *)b;
+	return (x > y) - (x < y);
+}
+
+void plant_report(void)
+{
+	unsigned landed = 0, correct = 0;
+	sim_time first = 0, last = 0, sum = 0;
+	sim_time *latency = calloc(fed ? fed : 1, sizeof(*latency));
+
+	for(unsigned i = 0; i < fed; i++)
+	{
+		struct item *it = &items[i];
+		if(it->state != LANDED) continue;
+		latency[landed++] = it->t_land - it->t_optic;
+		sum += it->t_land - it->t_optic;
+		correct += it->correct;
+		if(!first || it->t_optic < first) first = it->t_optic;
+		if(it->t_land > last) last = it->t_land;
+	}
+	qsort(latency, landed, sizeof(*latency), cmp_time);
+
+	double span = (double)(last - first) / SIM_S;
+	double ipm = span > 0.0 ? landed * 60.0 / span : 0.0;
+	double mean = landed ? (double)sum / landed / SIM_MS : 0.0;
+	double p50 = landed ? (double)latency[landed / 2] / SIM_MS : 0.0;
+	double max = landed ? (double)latency[landed - 1] / SIM_MS : 0.0;
+	double belt = sim_now > belt_first_run ? 100.0 * belt_run_time / (sim_now - belt_first_run) : 0.0;
+	double vmean = sim_now > belt_first_run ? belt_distance * SIM_S / (sim_now - belt_first_run) : 0.0;
+
+	printf("items      fed %u, landed %u, correct %u, missorted %u\n",
+		sim_opt.items, landed, correct, landed - correct);
+	printf("throughput %.1f items/min over %.2fs\n", ipm, span);
+	printf("latency    mean %.1fms, median %.1fms, max %.1fms (optic to bin)\n", mean, p50, max);
+	printf("belt       moving %.1f%% of the time, %u stops, %u exit edges\n", belt, belt_stops, exit_edges);
+	printf("           mean %.0fmm/s, peak %.0fmm/s\n", vmean, belt_vpeak);
+	printf("dish       %u steps, %u lost\n", steps, lost_steps);
+	printf("RESULT items=%u landed=%u correct=%u ipm=%.2f lat_mean_ms=%.1f lat_max_ms=%.1f stops=%u lost_steps=%u end_s=%.3f\n",
+		sim_opt.items, landed, correct, ipm, mean, max, belt_stops, lost_steps, (double)sim_now / SIM_S);
+	free(latency);
+}
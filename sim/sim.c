@@ -0,0 +1,79 @@
+/*
+ * sim.c
+ *
+ * Host entry point. Parses the run options, then hands control to the
+ * unmodified firmware main(), which runs until it halts after ramp down.
+ *
+ *   sorter-sim [-n items] [-p pitch_mm] [-s seed] [-b bounce] [-a drift]
+ *              [-t limit_s] [-P pause_s] [-e eeprom_file] [-u uart_file]
+ *              [-c command_file] [-l] [-v]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "sim.h"
+
+int firmware_main(int argc, char* argv[]);
+
+struct sim_options sim_opt =
+{
+	.items	= 48,
+	.pitch	= 80.0,
+	.seed	= 1,
+	.bounce	= 0.0,
+	.drift	= 0.0,
+	.limit	= 600.0,
+};
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"usage: %s [-n items] [-p pitch_mm] [-s seed] [-b bounce] [-a drift]\n"
+		"          [-t limit_s] [-P pause_s] [-e eeprom_file] [-u uart_file]\n"
+		"          [-c command_file] [-l] [-v]\n"
+		"  -n  items fed onto the belt (default %u)\n"
+		"  -p  centre-to-centre spacing at the feeder in mm (default %.0f)\n"
+		"  -s  random seed for item classes and sensor noise\n"
+		"  -b  probability of exit sensor chatter per item (0-1)\n"
+		"  -a  ambient light drift amplitude in ADC counts\n"
+		"  -t  give up after this many simulated seconds (default %.0f)\n"
+		"  -P  press pause at this time and again 2s later, with contact bounce\n"
+		"  -e  keep the EEPROM in this file between runs\n"
+		"  -u  write everything sent on USART0 to this file\n"
+		"  -c  send each line of this file to USART0 at the time in seconds\n"
+		"      it starts with\n"
+		"  -l  log LCD contents as they change\n"
+		"  -v  log every item as it lands\n",
+		name, sim_opt.items, sim_opt.pitch, sim_opt.limit);
+	exit(1);
+}
+
+int main(int argc, char* argv[])
+{
+	int opt;
+
+	while((opt = getopt(argc, argv, "n:p:s:b:a:t:P:e:u:c:lvh")) != -1)
+	{
+		switch(opt)
+		{
+			case 'n': sim_opt.items = strtoul(optarg, NULL, 0); break;
+			case 'p': sim_opt.pitch = strtod(optarg, NULL); break;
+			case 's': sim_opt.seed = strtoul(optarg, NULL, 0); break;
+			case 'b': sim_opt.bounce = strtod(optarg, NULL); break;
+			case 'a': sim_opt.drift = strtod(optarg, NULL); break;
+			case 't': sim_opt.limit = strtod(optarg, NULL); break;
+			case 'P': sim_opt.pause = strtod(optarg, NULL); break;
+			case 'e': sim_opt.eeprom = optarg; break;
+			case 'u': sim_opt.uart = optarg; break;
+			case 'c': sim_opt.commands = optarg; break;
+			case 'l': sim_opt.log_lcd = 1; break;
+			case 'v': sim_opt.verbose = 1; break;
+			default: usage(argv[0]);
+		}
+	}
+
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	return firmware_main(0, NULL);
+}
@@ -0,0 +1,89 @@
+/*
+ * sim.h
+ *
+ * Host-side plant simulator shared state. The firmware only ever sees hal.h;
+ * everything in here is private to sim/.
+ */
+
+
+#ifndef SIM_H_
+#define SIM_H_
+
+#include <stdint.h>
+
+// Simulated time is kept in nanoseconds
+typedef uint64_t sim_time;
+
+#define SIM_US		1000ULL
+#define SIM_MS		1000000ULL
+#define SIM_S		1000000000ULL
+
+// CPU time charged for every HAL access (roughly one short loop iteration
+// at 8MHz)
+#define SIM_POLL	(500ULL)
+
+// Interrupt sources, in ATmega2560 vector priority order
+enum
+{
+	SIM_IRQ_INT0,
+	SIM_IRQ_INT1,
+	SIM_IRQ_INT2,
+	SIM_IRQ_INT3,
+	SIM_IRQ_INT4,
+	SIM_IRQ_INT5,
+	SIM_IRQ_TIMER2,
+	SIM_IRQ_TIMER1,
+	SIM_IRQ_TIMER0_OVF,
+	SIM_IRQ_UART_RX,
+	SIM_IRQ_UART_UDRE,
+	SIM_IRQ_ADC,
+	SIM_IRQ_TIMER3,
+	SIM_IRQ_TIMER4,
+	SIM_IRQ_TIMER5_OVF,
+	SIM_IRQ_COUNT
+};
+
+// Run options, filled in by sim.c
+struct sim_options
+{
+	unsigned	items;		// Number of items to feed
+	double		pitch;		// Centre-to-centre item spacing at the feeder, mm
+	unsigned	seed;
+	double		bounce;		// Probability of exit sensor chatter per edge
+	double		drift;		// Ambient light drift amplitude, ADC counts
+	double		limit;		// Give up after this many simulated seconds
+	double		pause;		// Press pause at this time and again 2s later, 0 for never
+	const char	*eeprom;	// File backing the EEPROM, NULL to start blank every run
+	const char	*uart;		// File that receives the USART0 output, NULL to drop it
+	const char	*commands;	// Lines to send to USART0, each after its time in seconds
+	int		log_lcd;
+	int		verbose;
+};
+
+extern struct sim_options sim_opt;
+extern sim_time sim_now;
+
+/* hal_sim.c */
+void		sim_advance		(sim_time dt);
+void		sim_irq_raise		(int irq);
+
+/* plant.c */
+void		plant_init		(void);
+sim_time	plant_next_event	(void);
+void		plant_update		(sim_time now);
+void		plant_belt		(int run);
+void		plant_belt_duty		(uint8_t percent);
+void		plant_stepper		(uint8_t pattern);
+uint8_t		plant_optic		(void);
+uint16_t	plant_reflectance	(void);
+void		plant_report		(void);
+
+/* lcd_sim.c */
+void		lcd_sim_poll		(sim_time now);
+void		lcd_sim_dump		(void);
+
+/* Shared helpers */
+double		sim_random		(void);		// Uniform [0,1)
+double		sim_gauss		(void);		// Standard normal
+
+#endif /* SIM_H_ */
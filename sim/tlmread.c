@@ -0,0 +1,170 @@
+/*
+ * tlmread.c
+ *
+ * Host reader for the firmware's telemetry frames (see telemetry.h). Reads
+ * a capture of the serial line, or the line itself as it arrives, prints
+ * one line per frame and, at the end, any frames lost to the checksum or
+ * missing from the sequence. Answers to parameter commands (see param.h)
+ * are printed as they come, -q or not. Trace dumps on the same line are
+ * skipped.
+ *
+ *   tlmread [-q] [capture_file]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../telemetry.h"
+#include "../param.h"
+
+static uint16_t get16(const uint8_t *p)
+{
+	return p[0] | p[1] << 8;
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+	return get16(p) | (uint32_t)get16(p + 2) << 16;
+}
+
+static void print_frame(const uint8_t *p)
+{
+	uint8_t flags = p[15];
+
+	printf("%9.3fs  a%4u s%4u w%4u b%4u  queue %2u  %5.1f/min"
+	       "  lat %4u/%4ums  belt %2u%% (%2u%%)  dish %3u/%3u/%3ums  stray %u  lost %u%s%s%s\n",
+		get32(p) / 1000.0, get16(p + 4), get16(p + 6), get16(p + 8), get16(p + 10),
+		p[12], get16(p + 16) / 10.0,
+		get16(p + 18), get16(p + 20),
+		p[13], p[14],
+		get16(p + 22), get16(p + 24), get16(p + 26),
+		get16(p + 28), get16(p + 30),
+		flags & TELEMETRY_PAUSED ? "  paused" : "",
+		flags & TELEMETRY_RAMP_DOWN ? "  ramp down" : "",
+		flags & TELEMETRY_COMPLETE ? "  complete" : "");
+}
+
+static void print_param(const uint8_t *p, int len)
+{
+	int n = len - 8;
+
+	switch(p[0])
+	{
+		case PARAM_VALUE:
+		case PARAM_SET:
+		printf("param %.*s %s %u (%u..%u)\n", n, p + 8, p[0] == PARAM_SET ? "set to" : "=",
+			get16(p + 2), get16(p + 4), get16(p + 6));
+		break;
+
+		case PARAM_UNKNOWN:
+		printf("param %.*s: no such parameter\n", n, p + 8);
+		break;
+
+		case PARAM_RANGE:
+		printf("param %.*s: %u is outside %u..%u\n", n, p + 8, get16(p + 2), get16(p + 4), get16(p + 6));
+		break;
+
+		case PARAM_CONFLICT:
+		printf("param %.*s: %u is at odds with another parameter\n", n, p + 8, get16(p + 2));
+		break;
+
+		case PARAM_SYNTAX:
+		printf("param command not understood: %.*s\n", n, p + 8);
+		break;
+
+		default:
+		printf("param answer %u?\n", p[0]);
+	}
+}
+
+// Length, payload and checksum after 'T' 'P'; 1 if it checks out
+static int read_param(FILE *f)
+{
+	uint8_t frame[256];
+	int len = getc(f);
+
+	if(len == EOF || len < 8) return 0;
+	frame[0] = len;
+	if(fread(frame + 1, 1, len + 1, f) != (size_t)len + 1) return 0;
+
+	uint8_t sum = 0;
+	for(int i = 0; i < len + 2; i++) sum += frame[i];
+	if(sum) return 0;
+	print_param(frame + 1, len);
+	return 1;
+}
+
+int main(int argc, char *argv[])
+{
+	uint8_t frame[256];
+	unsigned got = 0, bad = 0, missing = 0, answers = 0;
+	int last = -1;
+	int quiet = 0;
+	int opt;
+
+	while((opt = getopt(argc, argv, "qh")) != -1)
+	{
+		switch(opt)
+		{
+			case 'q': quiet = 1; break;
+			default:
+			fprintf(stderr, "usage: %s [-q] [capture_file]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	FILE *f = stdin;
+	if(optind < argc && !(f = fopen(argv[optind], "rb")))
+	{
+		perror(argv[optind]);
+		return 1;
+	}
+	setvbuf(stdout, NULL, _IOLBF, 0);
+
+	// Sync on 'T' 'L', then length, sequence, payload and checksum. A
+	// frame that fails the checksum is dropped and the hunt for the next
+	// one starts after it. Longer payloads from newer firmware are read up
+	// to the fields known here.
+	int c, prev = -1;
+	while((c = getc(f)) != EOF)
+	{
+		if(prev == 'T' && c == 'P')
+		{
+			prev = -1;
+			if(read_param(f)) answers++;
+			else bad++;
+			continue;
+		}
+		if(prev != 'T' || c != 'L')
+		{
+			prev = c;
+			continue;
+		}
+		prev = -1;
+
+		int len = getc(f);
+		if(len == EOF) break;
+		frame[0] = len;
+		if(fread(frame + 1, 1, len + 2, f) != (size_t)len + 2) break;
+
+		uint8_t sum = 0;
+		for(int i = 0; i < len + 3; i++) sum += frame[i];
+		if(sum || len < TELEMETRY_BYTES)
+		{
+			bad++;
+			continue;
+		}
+
+		uint8_t seq = frame[1];
+		if(last >= 0) missing += (uint8_t)(seq - last - 1);
+		last = seq;
+		got++;
+		if(!quiet) print_frame(frame + 2);
+	}
+
+	printf("%u frames, %u failed the checksum, %u missing from the sequence", got, bad, missing);
+	if(answers) printf(", %u parameter answers", answers);
+	printf("\n");
+	return got ? 0 : 1;
+}
@@ -0,0 +1,301 @@
+/*
+ * tracedump.c
+ *
+ * Host decoder for the event trace the firmware sends over USART0 (see
+ * trace.h). Reads one or more dumps from a capture of the serial line and
+ * prints, for each, the items it covers as timelines in ms after their
+ * optic edge, then the faults. With -r every record is listed instead.
+ *
+ *   tracedump [-r] [capture_file]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../trace.h"
+
+// Record size on the wire
+#define RECORD_BYTES	8
+
+static const char *names[] =
+{
+	[TRACE_OPTIC]		= "optic",
+	[TRACE_MEASURED]	= "measured",
+	[TRACE_CLASS]		= "class",
+	[TRACE_ENQUEUE]		= "enqueue",
+	[TRACE_EXIT]		= "exit",
+	[TRACE_ARRIVE]		= "arrive",
+	[TRACE_RELEASE]		= "release",
+	[TRACE_LAND]		= "land",
+	[TRACE_MOVE]		= "move",
+	[TRACE_EXTEND]		= "extend",
+	[TRACE_MOVE_END]	= "move end",
+	[TRACE_BELT_RUN]	= "belt run",
+	[TRACE_BELT_STOP]	= "belt stop",
+	[TRACE_PAUSE]		= "pause",
+	[TRACE_RAMP]		= "ramp down",
+	[TRACE_DONE]		= "done",
+	[TRACE_FAULT]		= "FAULT",
+};
+
+static const char *faults[] =
+{
+	[FAULT_DISH_LOST]	= "dish lost its place",
+	[FAULT_QUEUE_FULL]	= "item queue full",
+	[FAULT_MEASURE_LOST]	= "measurement lost",
+	[FAULT_EXIT_LOST]	= "exit edge lost",
+};
+
+// What the trace says about one item, clock ticks
+struct timeline
+{
+	int		known;
+	int		has[TRACE_FAULT];
+	uint32_t	at[TRACE_FAULT];
+	uint32_t	optic;
+	char		cls;
+	unsigned	confidence;
+	unsigned	min;
+	int		by_edge;
+	int		held;
+};
+
+static const char *name(uint8_t type)
+{
+	if(type < sizeof(names) / sizeof(names[0]) && names[type]) return names[type];
+	return "?";
+}
+
+static void decode(const uint8_t *p, trace_record *r)
+{
+	r->type = p[0];
+	r->item = p[1];
+	r->value = p[2] | p[3] << 8;
+	r->time = p[4] | p[5] << 8 | p[6] << 16 | (uint32_t)p[7] << 24;
+}
+
+static void print_raw(const trace_record *r, unsigned n, unsigned ticks_ms)
+{
+	for(unsigned i = 0; i < n; i++)
+	{
+		printf("%10.3f  %-9s", r[i].time / (ticks_ms * 1000.0), name(r[i].type));
+		if(r[i].item != TRACE_NONE) printf("  item %3u", r[i].item);
+		else printf("          ");
+
+		switch(r[i].type)
+		{
+			case TRACE_CLASS:
+			printf("  %c %u%%", r[i].value & 0xFF, r[i].value >> 8);
+			break;
+
+			case TRACE_MOVE:
+			case TRACE_EXTEND:
+			printf("  %d steps", (int16_t)r[i].value);
+			break;
+
+			case TRACE_FAULT:
+			if(r[i].value < sizeof(faults) / sizeof(faults[0]) && faults[r[i].value])
+				printf("  %s", faults[r[i].value]);
+			break;
+
+			default:
+			printf("  %u", r[i].value);
+		}
+		printf("\n");
+	}
+}
+
+// Column for one event, ms after the optic edge
+static void column(const struct timeline *t, uint8_t type, unsigned ticks_ms)
+{
+	if(t->has[type] && t->has[TRACE_ENQUEUE]) printf("%8.0f", (int32_t)(t->at[type] - t->optic) / (double)ticks_ms);
+	else printf("%8s", "-");
+}
+
+static void print_row(unsigned id, const struct timeline *t, unsigned ticks_ms)
+{
+	printf("%4u  %c  ", id, t->cls ? t->cls : '?');
+	if(t->has[TRACE_CLASS]) printf("%3u%%", t->confidence);
+	else printf("%4s", "-");
+	if(t->has[TRACE_MEASURED]) printf(" %4u", t->min);
+	else printf(" %4s", "-");
+	if(t->has[TRACE_ENQUEUE]) printf("%10.3f", t->optic / (ticks_ms * 1000.0));
+	else printf("%10s", "-");
+
+	column(t, TRACE_MEASURED, ticks_ms);
+	column(t, TRACE_ENQUEUE, ticks_ms);
+	column(t, TRACE_ARRIVE, ticks_ms);
+	printf("%c", t->has[TRACE_ARRIVE] ? (t->by_edge ? 'e' : 't') : ' ');
+	column(t, TRACE_RELEASE, ticks_ms);
+	printf("%c", t->has[TRACE_RELEASE] && t->held ? 'h' : ' ');
+	column(t, TRACE_LAND, ticks_ms);
+	printf("\n");
+}
+
+static const struct timeline *sorting;
+
+// Items by when they reached the optic sensor
+static int by_optic(const void *a, const void *b)
+{
+	uint32_t x = sorting[*(const uint8_t *)a].optic;
+	uint32_t y = sorting[*(const uint8_t *)b].optic;
+	return (int32_t)(x - y) < 0 ? -1 : x != y;
+}
+
+// Ids wrap at 256 but a dump spans far fewer, so order them from one of them
+static uint8_t first_id;
+
+static int by_id(const void *a, const void *b)
+{
+	return (int8_t)(*(const uint8_t *)a - first_id) - (int8_t)(*(const uint8_t *)b - first_id);
+}
+
+static void print_items(const trace_record *r, unsigned n, unsigned ticks_ms)
+{
+	static struct timeline items[256];
+	uint8_t whole[256], partial[256];
+	unsigned wholes = 0, partials = 0;
+	unsigned landed = 0;
+	double total = 0, worst = 0;
+
+	memset(items, 0, sizeof(items));
+	for(unsigned i = 0; i < n; i++)
+	{
+		if(r[i].item == TRACE_NONE || r[i].type >= TRACE_FAULT) continue;
+
+		struct timeline *t = &items[r[i].item];
+		t->known = 1;
+		t->has[r[i].type] = 1;
+		t->at[r[i].type] = r[i].time;
+
+		switch(r[i].type)
+		{
+			case TRACE_MEASURED:
+			t->min = r[i].value;
+			break;
+
+			case TRACE_CLASS:
+			t->cls = r[i].value & 0xFF;
+			t->confidence = r[i].value >> 8;
+			break;
+
+			case TRACE_ENQUEUE:
+			t->optic = r[i].time - r[i].value * ticks_ms;
+			break;
+
+			case TRACE_ARRIVE:
+			t->by_edge = r[i].value;
+			break;
+
+			case TRACE_RELEASE:
+			t->held = r[i].value;
+			break;
+		}
+	}
+
+	// Items whose queueing is in the dump have a known optic time and are
+	// listed by it. The rest were queued before the ring wrapped past
+	// them, or never queued, and are listed apart by id.
+	for(unsigned i = 0; i < n; i++)
+	{
+		struct timeline *t = &items[r[i].item];
+		if(r[i].item == TRACE_NONE || !t->known) continue;
+		t->known = 0;
+
+		if(t->has[TRACE_ENQUEUE]) whole[wholes++] = r[i].item;
+		else partial[partials++] = r[i].item;
+	}
+	sorting = items;
+	qsort(whole, wholes, 1, by_optic);
+	if(partials) first_id = partial[0];
+	qsort(partial, partials, 1, by_id);
+
+	printf("item cls conf  min   optic s measured  queued    exit released  landed\n");
+	for(unsigned i = 0; i < wholes; i++)
+	{
+		const struct timeline *t = &items[whole[i]];
+		print_row(whole[i], t, ticks_ms);
+
+		if(t->has[TRACE_LAND])
+		{
+			double ms = (int32_t)(t->at[TRACE_LAND] - t->optic) / (double)ticks_ms;
+			total += ms;
+			if(ms > worst) worst = ms;
+			landed++;
+		}
+	}
+	printf("exit: e on its edge, t by time of flight; released: h after holding the belt\n");
+	if(partials)
+	{
+		printf("\nnot queued within the dump, times unknown:\n");
+		for(unsigned i = 0; i < partials; i++) print_row(partial[i], &items[partial[i]], ticks_ms);
+	}
+	if(landed) printf("optic to dish: mean %.0fms, max %.0fms over %u items\n", total / landed, worst, landed);
+
+	for(unsigned i = 0; i < n; i++)
+	{
+		if(r[i].type != TRACE_FAULT) continue;
+		printf("%10.3f  FAULT", r[i].time / (ticks_ms * 1000.0));
+		if(r[i].value < sizeof(faults) / sizeof(faults[0]) && faults[r[i].value])
+			printf(" %s", faults[r[i].value]);
+		printf("\n");
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	static uint8_t buf[1 << 20];
+	static trace_record records[256];
+	int raw = 0;
+	int opt;
+
+	while((opt = getopt(argc, argv, "rh")) != -1)
+	{
+		switch(opt)
+		{
+			case 'r': raw = 1; break;
+			default:
+			fprintf(stderr, "usage: %s [-r] [capture_file]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	FILE *f = stdin;
+	if(optind < argc && !(f = fopen(argv[optind], "rb")))
+	{
+		perror(argv[optind]);
+		return 1;
+	}
+	size_t len = fread(buf, 1, sizeof(buf), f);
+
+	// Other traffic may share the line, so hunt for frames that check out
+	unsigned dumps = 0;
+	for(size_t i = 0; i + 6 <= len; i++)
+	{
+		if(buf[i] != 'T' || buf[i + 1] != 'R') continue;
+
+		unsigned n = buf[i + 2] | buf[i + 3] << 8;
+		unsigned ticks_ms = buf[i + 4];
+		size_t end = i + 5 + n * RECORD_BYTES;
+		if(n > 256 || ticks_ms == 0 || end >= len) continue;
+
+		uint8_t sum = 0;
+		for(size_t j = i + 2; j <= end; j++) sum += buf[j];
+		if(sum) continue;
+
+		for(unsigned k = 0; k < n; k++) decode(&buf[i + 5 + k * RECORD_BYTES], &records[k]);
+
+		if(dumps++) printf("\n");
+		printf("dump %u: %u records", dumps, n);
+		if(n) printf(", %.3fs to %.3fs", records[0].time / (ticks_ms * 1000.0), records[n - 1].time / (ticks_ms * 1000.0));
+		printf("\n");
+
+		if(raw) print_raw(records, n, ticks_ms);
+		else print_items(records, n, ticks_ms);
+		i = end;
+	}
+	if(!dumps) fprintf(stderr, "no trace dumps found\n");
+	return dumps ? 0 : 1;
+}
@@ -0,0 +1,62 @@
+#include "uart.h"
+#include "telemetry.h"
+
+uint16_t telemetry_dropped = 0;
+
+static uint8_t sequence = 0;
+
+// Append little endian fields
+static uint8_t *put8(uint8_t *p, uint8_t v)
+{
+	*p = v;
+	return p + 1;
+}
+
+static uint8_t *put16(uint8_t *p, uint16_t v)
+{
+	p = put8(p, v);
+	return put8(p, v >> 8);
+}
+
+static uint8_t *put32(uint8_t *p, uint32_t v)
+{
+	p = put16(p, v);
+	return put16(p, v >> 16);
+}
+
+char telemetry_send(const telemetry *t)
+{
+	uint8_t frame[4 + TELEMETRY_BYTES + 1];
+	uint8_t *p = frame;
+
+	p = put8(p, 'T');
+	p = put8(p, 'L');
+	p = put8(p, TELEMETRY_BYTES);
+	p = put8(p, sequence);
+	p = put32(p, t->time);
+	p = put16(p, t->alum);
+	p = put16(p, t->steel);
+	p = put16(p, t->white);
+	p = put16(p, t->black);
+	p = put8(p, t->queued);
+	p = put8(p, t->duty);
+	p = put8(p, t->duty_mean);
+	p = put8(p, t->flags);
+	p = put16(p, t->ipm);
+	p = put16(p, t->latency_mean);
+	p = put16(p, t->latency_max);
+	p = put16(p, t->move_planned);
+	p = put16(p, t->move_actual);
+	p = put16(p, t->move_last);
+	p = put16(p, t->stray_edges);
+	p = put16(p, telemetry_dropped);
+
+	*p = -uart_sum(0, frame + 2, p - frame - 2);
+	p++;
+
+	// Let the host see how many went missing from the sequence
+	sequence++;
+	if(uart_send(frame, p - frame)) return 1;
+	telemetry_dropped++;
+	return 0;
+}
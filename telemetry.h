@@ -0,0 +1,51 @@
+/*
+ * telemetry.h
+ *
+ * Periodic status frames over USART0 for sim/tlmread or any host that
+ * listens. The main loop fills in a snapshot and telemetry_send() frames
+ * it into the UART ring; a frame that does not fit is dropped and counted,
+ * never waited for.
+ *
+ * Frame, little endian: 'T' 'L', payload length, sequence number, the
+ * payload below, then a byte that brings the sum of every byte after
+ * 'T' 'L' to zero. Trace dumps (trace.h) share the line.
+ */
+
+
+#ifndef TELEMETRY_H_
+#define TELEMETRY_H_
+
+#include <stdint.h>
+
+#define TELEMETRY_BYTES		32	// Payload length
+
+// Status flags
+#define TELEMETRY_PAUSED	0x01
+#define TELEMETRY_RAMP_DOWN	0x02
+#define TELEMETRY_COMPLETE	0x04
+
+typedef struct telemetry{
+	uint32_t time;		// ms since power up
+	uint16_t alum;		// Items at the exit sensor, by class
+	uint16_t steel;
+	uint16_t white;
+	uint16_t black;
+	uint8_t queued;		// Items between the optic sensor and the exit
+	uint8_t duty;		// Belt duty cycle %, now
+	uint8_t duty_mean;	// ... and averaged over the run
+	uint8_t flags;
+	uint16_t ipm;		// Items landed per minute, first arrival to last landing, x10
+	uint16_t latency_mean;	// Optic sensor to dish, ms
+	uint16_t latency_max;
+	uint16_t move_planned;	// Mean dish move time under the current profile, ms
+	uint16_t move_actual;
+	uint16_t move_last;	// Last dish move, ms
+	uint16_t stray_edges;	// Exit edges that matched no item
+				// Then telemetry_dropped, filled in by telemetry_send()
+} telemetry;
+
+char	telemetry_send	(const telemetry *t);	// Returns 0 if the frame was dropped
+
+extern uint16_t telemetry_dropped;		// Frames that found the UART ring full
+
+#endif /* TELEMETRY_H_ */
@@ -0,0 +1,122 @@
+#include "hal.h"
+#include "clock.h"
+#include "trace.h"
+#include "uart.h"
+
+static trace_record records[TRACE_SLOTS];
+static uint8_t next = 0;		// Slot for the next record
+static uint8_t full = 0;		// The ring has wrapped
+static uint8_t after = 0;		// Records left before freezing, 0 if no fault
+static uint8_t frozen = 0;
+static uint8_t fault = 0;		// Recorded since the last dump
+
+// Dump under way: 0 idle, 1 head to send, 2 records and check to send
+static uint8_t sending = 0;
+static uint8_t was_frozen;
+static uint8_t count;
+static uint8_t first;
+static uint8_t sent;
+static uint8_t sum;
+
+void trace_at(uint8_t type, uint8_t item, uint16_t value, uint32_t time)
+{
+	uint8_t state = hal_irq_save();
+
+	if(!frozen)
+	{
+		trace_record *r = &records[next];
+		r->type = type;
+		r->item = item;
+		r->value = value;
+		r->time = time;
+		next = (next + 1) & (TRACE_SLOTS - 1);
+		if(next == 0) full = 1;
+		if(after && --after == 0) frozen = 1;
+	}
+	hal_irq_restore(state);
+}
+
+void trace(uint8_t type, uint8_t item, uint16_t value)
+{
+	trace_at(type, item, value, clock_now());
+}
+
+void trace_fault(uint8_t code)
+{
+	trace(TRACE_FAULT, TRACE_NONE, code);
+
+	// A second fault before the freeze does not push it back
+	uint8_t state = hal_irq_save();
+	if(!frozen)
+	{
+		if(!after) after = TRACE_AFTER;
+		fault = 1;
+	}
+	hal_irq_restore(state);
+}
+
+char trace_faulted(void)
+{
+	return fault && frozen;
+}
+
+void trace_dump(void)
+{
+	if(sending) return;
+
+	// Freeze while sending, records made meanwhile are lost
+	uint8_t state = hal_irq_save();
+	was_frozen = frozen;
+	frozen = 1;
+	fault = 0;
+	hal_irq_restore(state);
+
+	count = full ? TRACE_SLOTS : next;
+	first = full ? next : 0;
+	sent = 0;
+	sum = 0;
+	sending = 1;
+}
+
+char trace_sending(void)
+{
+	return sending;
+}
+
+char trace_send(void)
+{
+	if(!sending) return 0;
+
+	// The head, every record, then the check, each queued whole or not yet
+	if(sending == 1)
+	{
+		uint8_t head[5] = { 'T', 'R', count, 0, CLOCK_MS(1) };
+		if(!uart_send(head, 5)) return 1;
+		sum = uart_sum(0, &head[2], 3);
+		sending = 2;
+	}
+	while(sent < count)
+	{
+		const trace_record *r = &records[(first + sent) & (TRACE_SLOTS - 1)];
+		uint8_t bytes[8] = { r->type, r->item, r->value, r->value >> 8,
+			r->time, r->time >> 8, r->time >> 16, r->time >> 24 };
+		if(!uart_send(bytes, 8)) return 1;
+		sum = uart_sum(sum, bytes, 8);
+		sent++;
+	}
+	uint8_t check = -sum;
+	if(!uart_send(&check, 1)) return 1;
+
+	// Any fault has been reported, and a frozen ring starts afresh
+	uint8_t state = hal_irq_save();
+	if(was_frozen)
+	{
+		next = 0;
+		full = 0;
+	}
+	after = 0;
+	frozen = 0;
+	hal_irq_restore(state);
+	sending = 0;
+	return 0;
+}
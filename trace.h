@@ -0,0 +1,69 @@
+/*
+ * trace.h
+ *
+ * Binary event trace. A RAM ring of fixed size records, each an event
+ * type, the item it concerns, a 16-bit value and the clock. Recording is a
+ * few stores with interrupts off, cheap enough for ISRs and left on in
+ * production. A fault lets TRACE_AFTER more records in and then freezes the
+ * ring, so what led up to it is kept. trace_dump() starts sending the ring
+ * over USART0, oldest record first, for sim/tracedump to decode, and
+ * trace_send() queues as much of it as the UART ring takes each time it
+ * is called, so nothing waits on the line. Other frames must hold off
+ * while trace_sending().
+ *
+ * Dump format, little endian: 'T' 'R', record count (16 bits), clock
+ * ticks per ms (8 bits), the records, then a byte that brings the sum of
+ * every byte after 'T' 'R' to zero.
+ */
+
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <stdint.h>
+
+#define TRACE_SLOTS	128	// Power of two, at most 128
+#define TRACE_AFTER	32	// Records kept after a fault before the ring freezes
+#define TRACE_NONE	0xFF	// Item id for events not tied to an item
+
+// Event types, with what 'value' holds
+#define TRACE_OPTIC	1	// Optic sensor edge
+#define TRACE_MEASURED	2	// Measurement window closed; lowest reflectance
+#define TRACE_CLASS	3	// Class letter, confidence % in the high byte
+#define TRACE_ENQUEUE	4	// ms since the item reached the optic sensor
+#define TRACE_EXIT	5	// Exit sensor edge
+#define TRACE_ARRIVE	6	// Item taken to be at the exit sensor; 1 on its edge, 0 by time of flight
+#define TRACE_RELEASE	7	// Item let go off the belt; 1 if the belt was held for it
+#define TRACE_LAND	8	// Item in the dish
+#define TRACE_MOVE	9	// Dish turn for the item started; full steps, negative counterclockwise
+#define TRACE_EXTEND	10	// ... or added to the move under way
+#define TRACE_MOVE_END	11	// Dish at rest; ms the move took
+#define TRACE_BELT_RUN	12	// Belt motor on; duty cycle %
+#define TRACE_BELT_STOP	13	// Belt motor off; 1 if paused
+#define TRACE_PAUSE	14	// 1 paused, 0 resumed
+#define TRACE_RAMP	15	// Ramp down started
+#define TRACE_DONE	16	// Ramp down complete
+#define TRACE_FAULT	17	// Fault code below
+
+// Fault codes
+#define FAULT_DISH_LOST		1	// Homing sensor missed, dish rehomed
+#define FAULT_QUEUE_FULL	2	// Item dropped by a full item queue
+#define FAULT_MEASURE_LOST	3	// Measurement not collected in time
+#define FAULT_EXIT_LOST		4	// Exit edge dropped by a full edge queue
+
+typedef struct trace_record{
+	uint8_t type;
+	uint8_t item;
+	uint16_t value;
+	uint32_t time;		// Clock at the event
+} trace_record;
+
+void	trace		(uint8_t type, uint8_t item, uint16_t value);			// Any context
+void	trace_at	(uint8_t type, uint8_t item, uint16_t value, uint32_t time);	// ... stamped earlier
+void	trace_fault	(uint8_t code);			// Record a fault and freeze the ring soon after
+char	trace_faulted	(void);				// The ring has frozen after a fault and waits to be dumped
+void	trace_dump	(void);				// Starts a dump, then restarts a frozen ring once it is sent
+char	trace_send	(void);				// Main loop; 1 while the dump has more to send
+char	trace_sending	(void);
+
+#endif /* TRACE_H_ */
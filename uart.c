@@ -0,0 +1,84 @@
+#include "hal.h"
+#include "uart.h"
+
+// The main loop is the only producer and the ISR the only consumer
+static uint8_t ring[UART_TX_SLOTS];
+static volatile uint8_t head = 0;	// Next byte to send, written by the ISR
+static volatile uint8_t tail = 0;	// Next free slot, written by the main loop
+
+// ... and the other way round
+static uint8_t rx[UART_RX_SLOTS];
+static volatile uint8_t rx_head = 0;	// Next byte to read, written by the main loop
+static volatile uint8_t rx_tail = 0;	// Next free slot, written by the ISR
+volatile uint8_t uart_overruns = 0;
+
+char uart_send(const void *buf, uint8_t len)
+{
+	const uint8_t *p = buf;
+	uint8_t t = tail;
+
+	if(UART_TX_SLOTS - (uint8_t)(t - head) < len) return 0;
+	while(len--) ring[t++ & (UART_TX_SLOTS - 1)] = *p++;
+	hal_barrier();
+	tail = t;
+	hal_uart_irq_enable();
+	return 1;
+}
+
+uint8_t uart_free(void)
+{
+	return UART_TX_SLOTS - (uint8_t)(tail - head);
+}
+
+void uart_flush(void)
+{
+	while(head != tail) hal_idle();
+}
+
+void uart_tx_ready(void)
+{
+	uint8_t h = head;
+
+	// Nothing left, stay quiet until uart_send() has more
+	if(h == tail)
+	{
+		hal_uart_irq_disable();
+		return;
+	}
+	hal_uart_send(ring[h & (UART_TX_SLOTS - 1)]);
+	head = h + 1;
+}
+
+uint8_t uart_sum(uint8_t sum, const void *buf, uint8_t len)
+{
+	const uint8_t *p = buf;
+
+	while(len--) sum += *p++;
+	return sum;
+}
+
+char uart_received(uint8_t byte)
+{
+	uint8_t t = rx_tail;
+
+	if((uint8_t)(t - rx_head) >= UART_RX_SLOTS)
+	{
+		uart_overruns++;
+		return 0;
+	}
+	rx[t & (UART_RX_SLOTS - 1)] = byte;
+	hal_barrier();
+	rx_tail = t + 1;
+	return byte == '\n' || byte == '\r';
+}
+
+char uart_read(uint8_t *byte)
+{
+	uint8_t h = rx_head;
+
+	if(h == rx_tail) return 0;
+	*byte = rx[h & (UART_RX_SLOTS - 1)];
+	hal_barrier();
+	rx_head = h + 1;
+	return 1;
+}
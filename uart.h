@@ -0,0 +1,30 @@
+/*
+ * uart.h
+ *
+ * Interrupt-driven USART0. The main loop queues bytes in a RAM ring and
+ * ISR(USART0_UDRE_vect) hands them to the hardware one at a time, so
+ * queueing never waits on the line. uart_send() takes a whole frame or
+ * nothing, so frames never go out torn. Received bytes go the other way
+ * through a second ring, from ISR(USART0_RX_vect) to uart_read().
+ */
+
+
+#ifndef UART_H_
+#define UART_H_
+
+#include <stdint.h>
+
+#define UART_TX_SLOTS	128	// Power of two, at most 128
+#define UART_RX_SLOTS	32	// Power of two, at most 128
+
+char	uart_send	(const void *buf, uint8_t len);	// Returns 0, queueing nothing, if there is no room
+uint8_t	uart_free	(void);				// Bytes uart_send() would take now
+void	uart_flush	(void);				// Waits until everything queued has gone out
+void	uart_tx_ready	(void);				// Data register empty, ISR context
+char	uart_received	(uint8_t byte);			// Byte in, ISR context; 1 if it ends a line
+char	uart_read	(uint8_t *byte);		// Returns 0 if nothing has come in
+uint8_t	uart_sum	(uint8_t sum, const void *buf, uint8_t len);	// Frames end in -sum of all bytes after the sync pair
+
+extern volatile uint8_t uart_overruns;			// Bytes lost to a full receive ring
+
+#endif /* UART_H_ */